@@ -141,7 +141,7 @@ int FdInStream::overrun(int itemSize, int nItems, bool wait)
 }
 
 #ifdef _WIN32
-static void gettimeofday(struct timeval* tv, void*)
+void rdr::gettimeofday(struct timeval* tv, void*)
 {
   LARGE_INTEGER counts, countsPerSec;
   static double usecPerCount = 0.0;
@@ -25,8 +25,18 @@
 
 #include <rdr/InStream.h>
 
+#ifdef _WIN32
+struct timeval;
+#endif
+
 namespace rdr {
 
+#ifdef _WIN32
+  // Win32 has no gettimeofday(), so FdInStream.cxx provides one for the
+  // streams which time themselves.
+  void gettimeofday(struct timeval* tv, void*);
+#endif
+
   class FdInStreamBlockCallback {
   public:
     virtual void blockCallback() = 0;
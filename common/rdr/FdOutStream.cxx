@@ -35,6 +35,9 @@
 
 #include <rdr/FdOutStream.h>
 #include <rdr/Exception.h>
+#ifdef _WIN32
+#include <rdr/FdInStream.h>
+#endif
 
 
 using namespace rdr;
@@ -44,7 +47,8 @@ enum { DEFAULT_BUF_SIZE = 16384,
 
 FdOutStream::FdOutStream(int fd_, int timeoutms_, int bufSize_)
   : fd(fd_), timeoutms(timeoutms_),
-    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    timeWaitedIn100us(0)
 {
   ptr = start = new U8[bufSize];
   end = start + bufSize;
@@ -126,6 +130,8 @@ int FdOutStream::overrun(int itemSize, int nItems)
 int FdOutStream::writeWithTimeout(const void* data, int length)
 {
   int n;
+  struct timeval before, after;
+  gettimeofday(&before, 0);
 
   do {
 
@@ -159,6 +165,11 @@ int FdOutStream::writeWithTimeout(const void* data, int length)
 
     if (n == 0) throw TimedOut();
 
+    gettimeofday(&after, 0);
+    timeWaitedIn100us += ((after.tv_sec - before.tv_sec) * 10000 +
+                          (after.tv_usec - before.tv_usec) / 100);
+    before = after;
+
     do {
       n = ::write(fd, data, length);
     } while (n < 0 && (errno == EINTR));
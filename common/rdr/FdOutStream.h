@@ -41,6 +41,11 @@ namespace rdr {
     int length();
     void writeBytes(const void* data, int length);
 
+    // timeWaited() returns the total time in units of 100us spent waiting
+    // for the fd to become writable, which gives a measure of how fast the
+    // other end is draining it.
+    unsigned int timeWaited() { return timeWaitedIn100us; }
+
   private:
     int overrun(int itemSize, int nItems);
     int writeWithTimeout(const void* data, int length);
@@ -48,6 +53,7 @@ namespace rdr {
     int timeoutms;
     int bufSize;
     int offset;
+    unsigned int timeWaitedIn100us;
     U8* start;
   };
 
@@ -25,7 +25,8 @@ using namespace rdr;
 enum { DEFAULT_BUF_SIZE = 16384 };
 
 ZlibOutStream::ZlibOutStream(OutStream* os, int bufSize_, int compressLevel)
-  : underlying(os), bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+  : underlying(os), bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    compressionLevel(compressLevel)
 {
   zs = new z_stream;
   zs->zalloc    = Z_NULL;
@@ -90,6 +91,29 @@ void ZlibOutStream::flush()
   ptr = start;
 }
 
+void ZlibOutStream::setCompressionLevel(int level)
+{
+  if (level == compressionLevel) return;
+
+  flush();
+
+  // After the flush there is no input pending, so deflateParams() has little
+  // or nothing to write.  Older versions of zlib return Z_BUF_ERROR when they
+  // have nothing to write, but they still change the level.
+
+  underlying->check(1);
+  zs->next_in = start;
+  zs->avail_in = 0;
+  zs->next_out = underlying->getptr();
+  zs->avail_out = underlying->getend() - underlying->getptr();
+  int rc = deflateParams(zs, level, Z_DEFAULT_STRATEGY);
+  if (rc != Z_OK && rc != Z_BUF_ERROR)
+    throw Exception("ZlibOutStream: deflateParams failed");
+  underlying->setptr(zs->next_out);
+
+  compressionLevel = level;
+}
+
 int ZlibOutStream::overrun(int itemSize, int nItems)
 {
 //    fprintf(stderr,"ZlibOutStream overrun\n");
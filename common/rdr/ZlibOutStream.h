@@ -41,6 +41,11 @@ namespace rdr {
     void flush();
     int length();
 
+    // setCompressionLevel() changes the compression level of the stream
+    // without resetting it.  Anything already written is flushed to the
+    // underlying stream first, compressed at the old level.
+    void setCompressionLevel(int level);
+
   private:
 
     int overrun(int itemSize, int nItems);
@@ -48,6 +53,7 @@ namespace rdr {
     OutStream* underlying;
     int bufSize;
     int offset;
+    int compressionLevel;
     z_stream_s* zs;
     U8* start;
   };
@@ -39,6 +39,10 @@ void CMsgHandler::setCursor(int w, int h, const Point& hotspot, void* data, void
 {
 }
 
+void CMsgHandler::setCursorPos(const Point& pos)
+{
+}
+
 void CMsgHandler::setPixelFormat(const PixelFormat& pf)
 {
   cp.setPF(pf);
@@ -97,4 +101,13 @@ void CMsgHandler::copyRect(const Rect& r, int srcX, int srcY)
 {
 }
 
+rdr::U8* CMsgHandler::getRawPixelsRW(const Rect& r, int* stride)
+{
+  return 0;
+}
+
+void CMsgHandler::releaseRawPixels(const Rect& r)
+{
+}
+
 
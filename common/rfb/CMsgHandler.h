@@ -45,6 +45,7 @@ namespace rfb {
     virtual void setDesktopSize(int w, int h);
     virtual void setCursor(int width, int height, const Point& hotspot,
                            void* data, void* mask);
+    virtual void setCursorPos(const Point& pos);
     virtual void setPixelFormat(const PixelFormat& pf);
     virtual void setName(const char* name);
     virtual void serverInit();
@@ -63,6 +64,15 @@ namespace rfb {
     virtual void imageRect(const Rect& r, void* pixels);
     virtual void copyRect(const Rect& r, int srcX, int srcY);
 
+    // getRawPixelsRW() lets a decoder write pixels in the format of cp.pf()
+    // straight into the framebuffer, rather than copying them with
+    // imageRect().  It returns a pointer to the top-left of the rectangle and
+    // the stride in pixels, or null if the decoder must use imageRect().  The
+    // decoder calls releaseRawPixels() with the same rectangle once all of it
+    // has been written.
+    virtual rdr::U8* getRawPixelsRW(const Rect& r, int* stride);
+    virtual void releaseRawPixels(const Rect& r);
+
     ConnParams cp;
   };
 }
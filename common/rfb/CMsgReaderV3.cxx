@@ -77,6 +77,9 @@ void CMsgReaderV3::readMsg()
     case pseudoEncodingCursor:
       readSetCursor(w, h, Point(x,y));
       break;
+    case pseudoEncodingCursorPos:
+      handler->setCursorPos(Point(x,y));
+      break;
     default:
       readRect(Rect(x, y, x+w, y+h), encoding);
       break;
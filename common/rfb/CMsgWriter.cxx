@@ -59,11 +59,17 @@ void CMsgWriter::writeSetEncodings(int nEncodings, rdr::U32* encodings)
 void CMsgWriter::writeSetEncodings(int preferredEncoding, bool useCopyRect)
 {
   int nEncodings = 0;
-  rdr::U32 encodings[encodingMax+2];
+  rdr::U32 encodings[encodingMax+6];
   if (cp->supportsLocalCursor)
     encodings[nEncodings++] = pseudoEncodingCursor;
   if (cp->supportsDesktopResize)
     encodings[nEncodings++] = pseudoEncodingDesktopSize;
+  if (cp->supportsCursorPos)
+    encodings[nEncodings++] = pseudoEncodingCursorPos;
+  if (cp->compressLevel >= 0 && cp->compressLevel <= 9)
+    encodings[nEncodings++] = pseudoEncodingCompressLevel0 + cp->compressLevel;
+  if (cp->scalePercent > 0 && cp->scalePercent < 100)
+    encodings[nEncodings++] = pseudoEncodingScalePercent1 + cp->scalePercent - 1;
   if (Decoder::supported(preferredEncoding)) {
     encodings[nEncodings++] = preferredEncoding;
   }
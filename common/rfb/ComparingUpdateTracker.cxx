@@ -16,6 +16,7 @@
  * USA.
  */
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <rdr/types.h>
 #include <rfb/Exception.h>
@@ -53,19 +54,25 @@ void ComparingUpdateTracker::compare()
     }
     firstCompare = false;
   } else {
-    copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
-    for (i = rects.begin(); i != rects.end(); i++)
-      oldFb.copyRect(*i, copy_delta);
+    CopyList::const_iterator op;
+    for (op = copies.begin(); op != copies.end(); op++) {
+      op->dest.get_rects(&rects, op->delta.x<=0, op->delta.y<=0);
+      for (i = rects.begin(); i != rects.end(); i++)
+        oldFb.copyRect(*i, op->delta);
+    }
 
-    Region to_check = changed.union_(copied);
+    Region to_check = changed.union_(get_copied());
     to_check.get_rects(&rects);
 
     Region newChanged;
     for (i = rects.begin(); i != rects.end(); i++)
       compareRect(*i, &newChanged);
 
-    copied.assign_subtract(newChanged);
+    removeFromCopies(newChanged);
     changed = newChanged;
+    for (int h = 0; h < numContentHints; h++)
+      if (!hints[h].is_empty())
+        hints[h].assign_intersect(changed);
   }
 }
 
@@ -135,3 +142,85 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
     newChanged->assign_union(temp);
   }
 }
+
+// findSolidAreas() looks for large areas of a single colour in the changed
+// region, such as window backgrounds, and hints them as fills.  The encoders
+// tile their input, so otherwise such an area would cost a tile header and a
+// palette pass for every tile it covers.  As a hint it is sent as one
+// rectangle of its own instead.
+//
+// Each rectangle of the changed region is scanned a row at a time, stopping
+// at the first pixel which differs.  A run of rows which are all the same
+// single colour counts if it is at least SOLID_MIN_HEIGHT rows and
+// SOLID_MIN_AREA pixels.
+
+#define SOLID_MIN_HEIGHT 16
+#define SOLID_MIN_AREA (64*64)
+
+template<class T>
+static inline bool isSolidRow(const rdr::U8* row, int width)
+{
+  const T* p = (const T*)row;
+  const T* end = p + width;
+  T pix = *p++;
+  while (p < end) {
+    if (*p++ != pix) return false;
+  }
+  return true;
+}
+
+static bool isSolidRow(const rdr::U8* row, int width, int bytesPerPixel)
+{
+  switch (bytesPerPixel) {
+  case 1: return isSolidRow<rdr::U8>(row, width);
+  case 2: return isSolidRow<rdr::U16>(row, width);
+  case 4: return isSolidRow<rdr::U32>(row, width);
+  }
+  for (int i = 1; i < width; i++) {
+    if (memcmp(row, row + i * bytesPerPixel, bytesPerPixel) != 0)
+      return false;
+  }
+  return true;
+}
+
+void ComparingUpdateTracker::findSolidAreas()
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+  changed.get_rects(&rects);
+
+  int bytesPerPixel = fb->getPF().bpp/8;
+  Region solid;
+
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (i->area() < SOLID_MIN_AREA || i->height() < SOLID_MIN_HEIGHT)
+      continue;
+
+    int stride;
+    const rdr::U8* data = fb->getPixelsR(*i, &stride);
+    int strideBytes = stride * bytesPerPixel;
+    int width = i->width();
+
+    const rdr::U8* runPixel = 0;
+    int runStart = 0;
+    for (int y = i->tl.y; y <= i->br.y; y++) {
+      const rdr::U8* row = data + (y - i->tl.y) * strideBytes;
+      bool solidRow = (y < i->br.y) && isSolidRow(row, width, bytesPerPixel);
+
+      if (solidRow && runPixel && memcmp(row, runPixel, bytesPerPixel) == 0)
+        continue;
+
+      if (runPixel) {
+        Rect run(i->tl.x, runStart, i->br.x, y);
+        if (run.height() >= SOLID_MIN_HEIGHT && run.area() >= SOLID_MIN_AREA)
+          solid.assign_union(Region(run));
+      }
+
+      runPixel = solidRow ? row : 0;
+      runStart = y;
+    }
+  }
+
+  if (!solid.is_empty())
+    add_hint(solid, hintFill);
+}
@@ -32,6 +32,10 @@ namespace rfb {
     // as appropriate.
 
     virtual void compare();
+
+    // findSolidAreas() hints any large areas of a single colour in the
+    // changed region as fills.
+    void findSolidAreas();
   private:
     void compareRect(const Rect& r, Region* newchanged);
     PixelBuffer* fb;
@@ -28,6 +28,8 @@ using namespace rfb;
 ConnParams::ConnParams()
   : majorVersion(0), minorVersion(0), width(0), height(0), useCopyRect(false),
     supportsLocalCursor(false), supportsDesktopResize(true),
+    supportsCursorPos(false),
+    compressLevel(-1), scalePercent(0),
     name_(0), nEncodings_(0), encodings_(0),
     currentEncoding_(encodingRaw), verStrPos(0)
 {
@@ -88,6 +90,9 @@ void ConnParams::setEncodings(int nEncodings, const rdr::U32* encodings)
   useCopyRect = false;
   supportsLocalCursor = false;
   supportsDesktopResize = false;
+  supportsCursorPos = false;
+  compressLevel = -1;
+  scalePercent = 0;
   currentEncoding_ = encodingRaw;
 
   for (int i = nEncodings-1; i >= 0; i--) {
@@ -99,7 +104,22 @@ void ConnParams::setEncodings(int nEncodings, const rdr::U32* encodings)
       supportsLocalCursor = true;
     else if (encodings[i] == pseudoEncodingDesktopSize)
       supportsDesktopResize = true;
+    else if (encodings[i] == pseudoEncodingCursorPos)
+      supportsCursorPos = true;
+    else if (encodings[i] >= pseudoEncodingCompressLevel0 &&
+             encodings[i] <= pseudoEncodingCompressLevel9)
+      compressLevel = encodings[i] - pseudoEncodingCompressLevel0;
+    else if (encodings[i] >= pseudoEncodingScalePercent1 &&
+             encodings[i] <= pseudoEncodingScalePercent100)
+      scalePercent = encodings[i] - pseudoEncodingScalePercent1 + 1;
     else if (encodings[i] <= encodingMax && Encoder::supported(encodings[i]))
       currentEncoding_ = encodings[i];
   }
 }
+
+bool ConnParams::supportsEncoding(rdr::U32 encoding)
+{
+  for (int i = 0; i < nEncodings_; i++)
+    if (encodings_[i] == encoding) return true;
+  return false;
+}
@@ -67,10 +67,20 @@ namespace rfb {
     int nEncodings() { return nEncodings_; }
     const rdr::U32* encodings() { return encodings_; }
     void setEncodings(int nEncodings, const rdr::U32* encodings);
+    bool supportsEncoding(rdr::U32 encoding);
     bool useCopyRect;
 
     bool supportsLocalCursor;
     bool supportsDesktopResize;
+    bool supportsCursorPos;
+
+    // compressLevel is the zlib compression level the client asked for, or -1
+    // to leave it to the server.
+    int compressLevel;
+
+    // scalePercent is the size the client asked the server to scale the
+    // framebuffer down to, as a percentage, or 0 for no scaling.
+    int scalePercent;
 
   private:
 
@@ -0,0 +1,349 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// ImageScaler.cxx
+//
+
+#include <string.h>
+#include <rfb/ImageScaler.h>
+#include <rfb/util.h>
+
+// The box filter spends its time adding up channels, which SSE2 (always
+// available on x86-64) and AVX2 (checked for at run time) can do several at a
+// time.  Other compilers and processors get the plain C version.
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define SCALER_SSE2
+#if __GNUC__ >= 5
+#include <immintrin.h>
+#define SCALER_AVX2
+#endif
+#endif
+#endif
+
+using namespace rfb;
+using namespace rdr;
+
+// addRow() adds n pixels' worth of 8-bit channels to 32-bit sums.
+
+typedef void (*addRowFn)(U32* acc, const U8* src, int n);
+
+static void addRowC(U32* acc, const U8* src, int n)
+{
+  for (int i = 0; i < n * 4; i++)
+    acc[i] += src[i];
+}
+
+#ifdef SCALER_SSE2
+static void addRowSSE2(U32* acc, const U8* src, int n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+    __m128i lo = _mm_unpacklo_epi8(p, zero);
+    __m128i hi = _mm_unpackhi_epi8(p, zero);
+    __m128i* a = (__m128i*)(acc + i * 4);
+    _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a),
+                                      _mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_si128(a+1, _mm_add_epi32(_mm_loadu_si128(a+1),
+                                        _mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_si128(a+2, _mm_add_epi32(_mm_loadu_si128(a+2),
+                                        _mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_si128(a+3, _mm_add_epi32(_mm_loadu_si128(a+3),
+                                        _mm_unpackhi_epi16(hi, zero)));
+  }
+  addRowC(acc + i * 4, src + i * 4, n - i);
+}
+#endif
+
+#ifdef SCALER_AVX2
+__attribute__((target("avx2")))
+static void addRowAVX2(U32* acc, const U8* src, int n)
+{
+  int i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    for (int j = 0; j < 32; j += 8) {
+      __m256i p = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i*)(src + i * 4 + j)));
+      __m256i* a = (__m256i*)(acc + i * 4 + j);
+      _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), p));
+    }
+  }
+  addRowC(acc + i * 4, src + i * 4, n - i);
+}
+#endif
+
+static addRowFn addRow = 0;
+static const char* simd = "C";
+
+static void chooseAddRow()
+{
+  if (addRow) return;
+  addRow = addRowC;
+#ifdef SCALER_SSE2
+  addRow = addRowSSE2;
+  simd = "SSE2";
+#endif
+#ifdef SCALER_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    addRow = addRowAVX2;
+    simd = "AVX2";
+  }
+#endif
+}
+
+// average() sums n pixels' worth of channel sums, and divides by the box area
+// by multiplying by recip, which is 65536 / area.
+
+static inline void average(const U32* acc, int n, U32 recip, U8* out)
+{
+#ifdef SCALER_SSE2
+  __m128i s = _mm_setzero_si128();
+  for (int k = 0; k < n; k++)
+    s = _mm_add_epi32(s, _mm_loadu_si128((const __m128i*)(acc + k * 4)));
+  const __m128i rv = _mm_set1_epi32(recip);
+  const __m128i round = _mm_set_epi32(0, 0x8000, 0, 0x8000);
+  __m128i even = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(s, rv), round),
+                                16);
+  __m128i odd = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(
+                                 _mm_srli_epi64(s, 32), rv), round), 16);
+  __m128i v = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+  v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+  U32 pixel = _mm_cvtsi128_si32(v);
+  memcpy(out, &pixel, 4);
+#else
+  U32 sum[4] = { 0, 0, 0, 0 };
+  for (int k = 0; k < n; k++)
+    for (int c = 0; c < 4; c++)
+      sum[c] += acc[k * 4 + c];
+  for (int c = 0; c < 4; c++) {
+    U32 v = (sum[c] * recip + 0x8000) >> 16;
+    out[c] = v > 255 ? 255 : v;
+  }
+#endif
+}
+
+template<class T>
+static void scaleNearest(const T* src, int srcStride, T* dst, int dstStride,
+                         const Rect& r, const int* xNear, const int* yNear)
+{
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    const T* s = src + yNear[y] * srcStride;
+    T* d = dst + y * dstStride;
+    for (int x = r.tl.x; x < r.br.x; x++)
+      d[x] = s[xNear[x]];
+  }
+}
+
+
+ImageScaler::ImageScaler()
+  : srcWidth(0), srcHeight(0), dstWidth(0), dstHeight(0), bpp(32),
+    filter(box), xStart(0), xEnd(0), xNear(0), yStart(0), yEnd(0), yNear(0),
+    xLeft(0), xWeight(0), yLeft(0), yWeight(0)
+{
+  chooseAddRow();
+}
+
+ImageScaler::~ImageScaler()
+{
+  delete [] xStart;
+  delete [] xEnd;
+  delete [] xNear;
+  delete [] yStart;
+  delete [] yEnd;
+  delete [] yNear;
+  delete [] xLeft;
+  delete [] xWeight;
+  delete [] yLeft;
+  delete [] yWeight;
+}
+
+static void makeTables(int srcSize, int dstSize,
+                       int** start, int** end, int** near)
+{
+  delete [] *start;
+  delete [] *end;
+  delete [] *near;
+  *start = new int[dstSize];
+  *end = new int[dstSize];
+  *near = new int[dstSize];
+  for (int i = 0; i < dstSize; i++) {
+    (*start)[i] = i * srcSize / dstSize;
+    (*end)[i] = __rfbmax((i + 1) * srcSize / dstSize, (*start)[i] + 1);
+    (*near)[i] = (2 * i + 1) * srcSize / (2 * dstSize);
+  }
+}
+
+// The centre of scaled pixel i lies at (2i+1)/2 * srcSize/dstSize in the
+// source, and so between the centres of source pixels left and left+1 where
+// left is that less a half.  Positions beyond the first or last centre take
+// the edge pixel.
+
+static void makeBilinearTables(int srcSize, int dstSize,
+                               int** left, int** weight)
+{
+  delete [] *left;
+  delete [] *weight;
+  *left = new int[dstSize];
+  *weight = new int[dstSize];
+  for (int i = 0; i < dstSize; i++) {
+    // In 256ths of a source pixel.
+    int pos = (int)(((i + 0.5) * srcSize / dstSize - 0.5) * 256 + 0.5);
+    if (pos < 0)
+      pos = 0;
+    if (pos > (srcSize - 1) * 256)
+      pos = (srcSize - 1) * 256;
+    (*left)[i] = pos >> 8;
+    (*weight)[i] = pos & 255;
+  }
+}
+
+void ImageScaler::init(int srcWidth_, int srcHeight_,
+                       int dstWidth_, int dstHeight_, int bpp_, Filter filter_)
+{
+  srcWidth = srcWidth_;
+  srcHeight = srcHeight_;
+  dstWidth = dstWidth_;
+  dstHeight = dstHeight_;
+  bpp = bpp_;
+  filter = (bpp == 32) ? filter_ : nearest;
+  makeTables(srcWidth, dstWidth, &xStart, &xEnd, &xNear);
+  makeTables(srcHeight, dstHeight, &yStart, &yEnd, &yNear);
+  makeBilinearTables(srcWidth, dstWidth, &xLeft, &xWeight);
+  makeBilinearTables(srcHeight, dstHeight, &yLeft, &yWeight);
+}
+
+// A source pixel only affects the scaled pixels whose boxes contain it (or
+// are nearest to it), so one scaled pixel's margin either side is enough.
+// The bilinear filter also blends it into the scaled pixels whose centres lie
+// up to a source pixel away, so the rectangle is widened by that first.
+
+Rect ImageScaler::scaledRect(const Rect& r_) const
+{
+  Rect r = r_;
+  if (filter == bilinear) {
+    r.tl.x--;
+    r.tl.y--;
+    r.br.x++;
+    r.br.y++;
+  }
+  Rect sr;
+  sr.tl.x = r.tl.x * dstWidth / srcWidth - 1;
+  sr.tl.y = r.tl.y * dstHeight / srcHeight - 1;
+  sr.br.x = (r.br.x * dstWidth + srcWidth - 1) / srcWidth + 1;
+  sr.br.y = (r.br.y * dstHeight + srcHeight - 1) / srcHeight + 1;
+  return sr.intersect(Rect(0, 0, dstWidth, dstHeight));
+}
+
+void ImageScaler::scale(const void* src, int srcStride,
+                        void* dst, int dstStride, const Rect& r_) const
+{
+  Rect r = r_.intersect(Rect(0, 0, dstWidth, dstHeight));
+  if (r.is_empty()) return;
+
+  if (filter == box) {
+    scaleBox((const U8*)src, srcStride, (U8*)dst, dstStride, r);
+    return;
+  }
+  if (filter == bilinear) {
+    scaleBilinear((const U8*)src, srcStride, (U8*)dst, dstStride, r);
+    return;
+  }
+
+  switch (bpp) {
+  case 8:
+    scaleNearest((const U8*)src, srcStride, (U8*)dst, dstStride, r,
+                 xNear, yNear);
+    break;
+  case 16:
+    scaleNearest((const U16*)src, srcStride, (U16*)dst, dstStride, r,
+                 xNear, yNear);
+    break;
+  case 32:
+    scaleNearest((const U32*)src, srcStride, (U32*)dst, dstStride, r,
+                 xNear, yNear);
+    break;
+  }
+}
+
+// scaleBox() works a row of scaled pixels at a time.  The source rows under
+// the row are first added up column by column, then each scaled pixel adds up
+// the columns under it.
+
+void ImageScaler::scaleBox(const U8* src, int srcStride,
+                           U8* dst, int dstStride, const Rect& r) const
+{
+  int sx = xStart[r.tl.x];
+  int n = xEnd[r.br.x - 1] - sx;
+  U32* acc = new U32[n * 4];
+
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    memset(acc, 0, n * 4 * sizeof(U32));
+    for (int sy = yStart[y]; sy < yEnd[y]; sy++)
+      addRow(acc, src + (sy * srcStride + sx) * 4, n);
+
+    int h = yEnd[y] - yStart[y];
+    U8* d = dst + (y * dstStride + r.tl.x) * 4;
+    for (int x = r.tl.x; x < r.br.x; x++) {
+      int w = xEnd[x] - xStart[x];
+      U32 recip = (65536 + w * h / 2) / (w * h);
+      average(acc + (xStart[x] - sx) * 4, w, recip, d);
+      d += 4;
+    }
+  }
+
+  delete [] acc;
+}
+
+// scaleBilinear() blends each channel of the two source rows first, with
+// weights out of 256, and then blends the two columns.  The sum is in 65536ths
+// and is rounded to the nearest.
+
+void ImageScaler::scaleBilinear(const U8* src, int srcStride,
+                                U8* dst, int dstStride, const Rect& r) const
+{
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    const U8* s0 = src + yLeft[y] * srcStride * 4;
+    const U8* s1 = s0 + (yLeft[y] + 1 < srcHeight ? srcStride * 4 : 0);
+    U32 wy1 = yWeight[y];
+    U32 wy0 = 256 - wy1;
+    U8* d = dst + (y * dstStride + r.tl.x) * 4;
+    for (int x = r.tl.x; x < r.br.x; x++) {
+      int i0 = xLeft[x] * 4;
+      int i1 = i0 + (xLeft[x] + 1 < srcWidth ? 4 : 0);
+      U32 wx1 = xWeight[x];
+      U32 wx0 = 256 - wx1;
+      for (int c = 0; c < 4; c++) {
+        U32 left = s0[i0 + c] * wy0 + s1[i0 + c] * wy1;
+        U32 right = s0[i1 + c] * wy0 + s1[i1 + c] * wy1;
+        d[c] = (left * wx0 + right * wx1 + 0x8000) >> 16;
+      }
+      d += 4;
+    }
+  }
+}
+
+const char* ImageScaler::simdName()
+{
+  chooseAddRow();
+  return simd;
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// ImageScaler - scales rectangles of an image to a different size.
+//
+// The box filter averages all the source pixels which fall within each scaled
+// pixel, which gives a good result when shrinking.  The bilinear filter
+// blends the four source pixels around the centre of each scaled pixel, which
+// is smoother when enlarging.  Both only work on 32-bit pixels with 8-bit
+// channels; other depths always use the nearest filter.
+//
+
+#ifndef __RFB_IMAGESCALER_H__
+#define __RFB_IMAGESCALER_H__
+
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  class ImageScaler {
+  public:
+    enum Filter { nearest, box, bilinear };
+
+    ImageScaler();
+    ~ImageScaler();
+
+    // init() sets the sizes of the source and scaled images.  bpp is the
+    // number of bits per pixel of both.
+
+    void init(int srcWidth, int srcHeight, int dstWidth, int dstHeight,
+              int bpp, Filter filter);
+
+    // scaledRect() returns the part of the scaled image which depends on the
+    // given rectangle of the source image.
+
+    Rect scaledRect(const Rect& r) const;
+
+    // scale() fills the given rectangle of the scaled image from the source
+    // image.  Strides are in pixels.  It may be called from several threads at
+    // once for different rectangles.
+
+    void scale(const void* src, int srcStride,
+               void* dst, int dstStride, const Rect& r) const;
+
+    // simdName() says which instruction set the box filter is using.
+
+    static const char* simdName();
+
+  private:
+    void scaleBox(const rdr::U8* src, int srcStride,
+                  rdr::U8* dst, int dstStride, const Rect& r) const;
+    void scaleBilinear(const rdr::U8* src, int srcStride,
+                       rdr::U8* dst, int dstStride, const Rect& r) const;
+
+    int srcWidth, srcHeight, dstWidth, dstHeight, bpp;
+    Filter filter;
+
+    // Scaled pixel x covers source columns xStart[x] to xEnd[x]-1 (and
+    // likewise for rows), and its nearest source column is xNear[x].
+    int* xStart;
+    int* xEnd;
+    int* xNear;
+    int* yStart;
+    int* yEnd;
+    int* yNear;
+
+    // The bilinear filter blends source column xLeft[x] and the one after it
+    // (or the same one at the right hand edge), giving the second a weight of
+    // xWeight[x] out of 256, and likewise for rows.
+    int* xLeft;
+    int* xWeight;
+    int* yLeft;
+    int* yWeight;
+  };
+
+}
+#endif
@@ -21,6 +21,7 @@
 // The PixelBuffer class encapsulates the PixelFormat and dimensions
 // of a block of pixel data.
 
+#include <string.h>
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
 #include <rfb/PixelBuffer.h>
@@ -31,6 +32,259 @@ using namespace rdr;
 static LogWriter vlog("PixelBuffer");
 
 
+// -=- Pixel kernels
+//
+// The inner loops of fillRect() and maskRect() are done with the widest
+// stores the processor has - SSE2 (always available on x86-64), or AVX2 if
+// it is found at run time.  Other compilers and processors get the plain C
+// versions.  Copies are left to memcpy() and memmove(), which already do this.
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define KERNEL_SSE2
+#if __GNUC__ >= 5
+#include <immintrin.h>
+#define KERNEL_AVX2
+#endif
+#endif
+#endif
+
+// The kernels in use are indexed by bytes per pixel, with 3 unused.
+
+static FillRowFn fillRow[5];
+static MaskRowFn maskRow[5];
+
+static void fillRow8(U8* dst, Pixel pix, int n)
+{
+  memset(dst, pix, n);
+}
+
+template<class T>
+static void fillRowC(U8* dst, Pixel pix, int n)
+{
+  T* p = (T*)dst;
+  T v = pix;
+  for (int i = 0; i < n; i++)
+    p[i] = v;
+}
+
+template<class T>
+static inline void maskPixel(T* dst, const T* src, const U8* mask, int x)
+{
+  if (mask[x / 8] & (0x80 >> (x % 8)))
+    *dst = *src;
+}
+
+template<class T>
+static void maskRowC(U8* dst_, const U8* src_, const U8* mask, int x, int n)
+{
+  T* dst = (T*)dst_;
+  const T* src = (const T*)src_;
+  int i = 0;
+  for (; i < n && (x + i) % 8; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+  for (; i + 8 <= n; i += 8) {
+    U8 byte = mask[(x + i) / 8];
+    if (byte == 0xff) {
+      memcpy(dst + i, src + i, 8 * sizeof(T));
+    } else if (byte) {
+      for (int j = 0; j < 8; j++)
+        if (byte & (0x80 >> j)) dst[i + j] = src[i + j];
+    }
+  }
+  for (; i < n; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+}
+
+#ifdef KERNEL_SSE2
+// The pattern holds a whole number of pixels, so the last partial store can
+// simply take the start of it.
+
+static inline void fillBytesSSE2(U8* dst, __m128i pattern, int bytes)
+{
+  int i;
+  for (i = 0; i + 16 <= bytes; i += 16)
+    _mm_storeu_si128((__m128i*)(dst + i), pattern);
+  if (i < bytes) {
+    U8 tail[16];
+    _mm_storeu_si128((__m128i*)tail, pattern);
+    memcpy(dst + i, tail, bytes - i);
+  }
+}
+
+static void fillRow16SSE2(U8* dst, Pixel pix, int n)
+{
+  fillBytesSSE2(dst, _mm_set1_epi16(pix), n * 2);
+}
+
+static void fillRow32SSE2(U8* dst, Pixel pix, int n)
+{
+  fillBytesSSE2(dst, _mm_set1_epi32(pix), n * 4);
+}
+
+// The masked rows are blended eight pixels - one byte of mask - at a time.
+// Each lane of bits picks out the mask bit for its pixel.
+
+static inline __m128i blendSSE2(__m128i dst, __m128i src, __m128i sel)
+{
+  return _mm_or_si128(_mm_and_si128(sel, src), _mm_andnot_si128(sel, dst));
+}
+
+static void maskRow16SSE2(U8* dst_, const U8* src_, const U8* mask, int x,
+                          int n)
+{
+  U16* dst = (U16*)dst_;
+  const U16* src = (const U16*)src_;
+  const __m128i bits = _mm_set_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+  int i = 0;
+  for (; i < n && (x + i) % 8; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+  for (; i + 8 <= n; i += 8) {
+    U8 byte = mask[(x + i) / 8];
+    if (!byte) continue;
+    __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i* d = (__m128i*)(dst + i);
+    if (byte != 0xff) {
+      __m128i sel = _mm_and_si128(_mm_set1_epi16(byte), bits);
+      s = blendSSE2(_mm_loadu_si128(d), s, _mm_cmpeq_epi16(sel, bits));
+    }
+    _mm_storeu_si128(d, s);
+  }
+  for (; i < n; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+}
+
+static void maskRow32SSE2(U8* dst_, const U8* src_, const U8* mask, int x,
+                          int n)
+{
+  U32* dst = (U32*)dst_;
+  const U32* src = (const U32*)src_;
+  const __m128i bitsLo = _mm_set_epi32(16, 32, 64, 128);
+  const __m128i bitsHi = _mm_set_epi32(1, 2, 4, 8);
+  int i = 0;
+  for (; i < n && (x + i) % 8; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+  for (; i + 8 <= n; i += 8) {
+    U8 byte = mask[(x + i) / 8];
+    if (!byte) continue;
+    __m128i s0 = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i s1 = _mm_loadu_si128((const __m128i*)(src + i + 4));
+    __m128i* d = (__m128i*)(dst + i);
+    if (byte != 0xff) {
+      __m128i m = _mm_set1_epi32(byte);
+      __m128i sel0 = _mm_cmpeq_epi32(_mm_and_si128(m, bitsLo), bitsLo);
+      __m128i sel1 = _mm_cmpeq_epi32(_mm_and_si128(m, bitsHi), bitsHi);
+      s0 = blendSSE2(_mm_loadu_si128(d), s0, sel0);
+      s1 = blendSSE2(_mm_loadu_si128(d + 1), s1, sel1);
+    }
+    _mm_storeu_si128(d, s0);
+    _mm_storeu_si128(d + 1, s1);
+  }
+  for (; i < n; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+}
+#endif
+
+#ifdef KERNEL_AVX2
+__attribute__((target("avx2")))
+static inline void fillBytesAVX2(U8* dst, __m128i pattern128, int bytes)
+{
+  __m256i pattern = _mm256_broadcastsi128_si256(pattern128);
+  int i;
+  for (i = 0; i + 32 <= bytes; i += 32)
+    _mm256_storeu_si256((__m256i*)(dst + i), pattern);
+  if (i < bytes)
+    fillBytesSSE2(dst + i, pattern128, bytes - i);
+}
+
+__attribute__((target("avx2")))
+static void fillRow16AVX2(U8* dst, Pixel pix, int n)
+{
+  fillBytesAVX2(dst, _mm_set1_epi16(pix), n * 2);
+}
+
+__attribute__((target("avx2")))
+static void fillRow32AVX2(U8* dst, Pixel pix, int n)
+{
+  fillBytesAVX2(dst, _mm_set1_epi32(pix), n * 4);
+}
+
+__attribute__((target("avx2")))
+static void maskRow32AVX2(U8* dst_, const U8* src_, const U8* mask, int x,
+                          int n)
+{
+  U32* dst = (U32*)dst_;
+  const U32* src = (const U32*)src_;
+  const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  int i = 0;
+  for (; i < n && (x + i) % 8; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+  for (; i + 8 <= n; i += 8) {
+    U8 byte = mask[(x + i) / 8];
+    if (!byte) continue;
+    __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i* d = (__m256i*)(dst + i);
+    if (byte != 0xff) {
+      __m256i sel = _mm256_and_si256(_mm256_set1_epi32(byte), bits);
+      s = _mm256_blendv_epi8(_mm256_loadu_si256(d), s,
+                             _mm256_cmpeq_epi32(sel, bits));
+    }
+    _mm256_storeu_si256(d, s);
+  }
+  for (; i < n; i++)
+    maskPixel(dst + i, src + i, mask, x + i);
+}
+#endif
+
+static const PixelKernel allKernels[] = {
+  { "C", 1, fillRow8, maskRowC<U8> },
+  { "C", 2, fillRowC<U16>, maskRowC<U16> },
+  { "C", 4, fillRowC<U32>, maskRowC<U32> },
+#ifdef KERNEL_SSE2
+  { "SSE2", 2, fillRow16SSE2, maskRow16SSE2 },
+  { "SSE2", 4, fillRow32SSE2, maskRow32SSE2 },
+#endif
+#ifdef KERNEL_AVX2
+  { "AVX2", 2, fillRow16AVX2, 0 },
+  { "AVX2", 4, fillRow32AVX2, maskRow32AVX2 },
+#endif
+  { 0, 0, 0, 0 }
+};
+
+const PixelKernel* rfb::pixelKernels()
+{
+  static PixelKernel supported[sizeof(allKernels) / sizeof(allKernels[0])];
+  if (supported[0].name) return supported;
+  bool avx2 = false;
+#ifdef KERNEL_AVX2
+  __builtin_cpu_init();
+  avx2 = __builtin_cpu_supports("avx2");
+#endif
+  int n = 0;
+  for (const PixelKernel* k = allKernels; k->name; k++) {
+    if (!avx2 && strcmp(k->name, "AVX2") == 0) continue;
+    supported[n++] = *k;
+  }
+  return supported;
+}
+
+// chooseKernels() takes the widest version of each kernel, which is the last
+// one listed.
+
+static void chooseKernels()
+{
+  if (fillRow[1]) return;
+  const char* simd = "C";
+  for (const PixelKernel* k = pixelKernels(); k->name; k++) {
+    if (k->fillRow) fillRow[k->bytesPerPixel] = k->fillRow;
+    if (k->maskRow) maskRow[k->bytesPerPixel] = k->maskRow;
+    simd = k->name;
+  }
+  vlog.debug("using %s pixel kernels", simd);
+}
+
+
 // -=- Generic pixel buffer class
 
 PixelBuffer::PixelBuffer(const PixelFormat& pf, int w, int h, ColourMap* cm)
@@ -56,6 +310,10 @@ PixelBuffer::getImage(void* imageBuf, const Rect& r, int outStride) {
   int outBytesPerRow = outStride * bytesPerPixel;
   int bytesPerMemCpy = r.width() * bytesPerPixel;
   U8* imageBufPos = (U8*)imageBuf;
+  if (inStride == r.width() && outStride == r.width()) {
+    memcpy(imageBufPos, data, bytesPerMemCpy * r.height());
+    return;
+  }
   const U8* end = data + (inBytesPerRow * r.height());
   while (data < end) {
     memcpy(imageBufPos, data, bytesPerMemCpy);
@@ -82,9 +340,13 @@ FullFramePixelBuffer::FullFramePixelBuffer(const PixelFormat& pf, int w, int h,
                                            rdr::U8* data_, ColourMap* cm)
   : PixelBuffer(pf, w, h, cm), data(data_)
 {
+  chooseKernels();
 }
 
-FullFramePixelBuffer::FullFramePixelBuffer() : data(0) {}
+FullFramePixelBuffer::FullFramePixelBuffer() : data(0)
+{
+  chooseKernels();
+}
 
 FullFramePixelBuffer::~FullFramePixelBuffer() {}
 
@@ -103,31 +365,18 @@ void FullFramePixelBuffer::fillRect(const Rect& r, Pixel pix) {
   U8* data = getPixelsRW(r, &stride);
   int bytesPerPixel = getPF().bpp/8;
   int bytesPerRow = bytesPerPixel * stride;
-  int bytesPerFill = bytesPerPixel * r.width();
+  int w = r.width();
+  int h = r.height();
 
-  U8* end = data + (bytesPerRow * r.height());
-  while (data < end) {
-    switch (bytesPerPixel) {
-    case 1:
-      memset(data, pix, bytesPerFill);
-      break;
-    case 2:
-      {
-        U16* optr = (U16*)data;
-        U16* eol = optr + r.width();
-        while (optr < eol)
-          *optr++ = pix;
-      }
-      break;
-    case 4:
-      {
-        U32* optr = (U32*)data;
-        U32* eol = optr + r.width();
-        while (optr < eol)
-          *optr++ = pix;
-      }
-      break;
-    }
+  // Rows which run the full width of the buffer are filled as one
+  if (w == stride) {
+    w *= h;
+    h = 1;
+  }
+
+  FillRowFn fill = fillRow[bytesPerPixel];
+  for (int y = 0; y < h; y++) {
+    fill(data, pix, w);
     data += bytesPerRow;
   }
 }
@@ -141,6 +390,10 @@ void FullFramePixelBuffer::imageRect(const Rect& r, const void* pixels, int srcS
   int bytesPerSrcRow = bytesPerPixel * srcStride;
   int bytesPerFill = bytesPerPixel * r.width();
   const U8* src = (const U8*)pixels;
+  if (srcStride == r.width() && destStride == r.width()) {
+    memcpy(dest, src, bytesPerFill * r.height());
+    return;
+  }
   U8* end = dest + (bytesPerDestRow * r.height());
   while (dest < end) {
     memcpy(dest, src, bytesPerFill);
@@ -157,32 +410,20 @@ void FullFramePixelBuffer::maskRect(const Rect& r, const void* pixels, const voi
   U8* mask = (U8*) mask_;
   int w = cr.width();
   int h = cr.height();
-  int bpp = getPF().bpp;
+  int bytesPerPixel = getPF().bpp/8;
   int pixelStride = r.width();
   int maskStride = (r.width() + 7) / 8;
 
   Point offset = Point(cr.tl.x-r.tl.x, cr.tl.y-r.tl.y);
   mask += offset.y * maskStride;
+  const U8* src = (const U8*)pixels +
+    (offset.y * pixelStride + offset.x) * bytesPerPixel;
+
+  MaskRowFn copy = maskRow[bytesPerPixel];
   for (int y = 0; y < h; y++) {
-    int cy = offset.y + y;
-    for (int x = 0; x < w; x++) {
-      int cx = offset.x + x;
-      U8* byte = mask + (cx / 8);
-      int bit = 7 - cx % 8;
-      if ((*byte) & (1 << bit)) {
-        switch (bpp) {
-        case 8:
-          ((U8*)data)[y * stride + x] = ((U8*)pixels)[cy * pixelStride + cx];
-          break;
-        case 16:
-          ((U16*)data)[y * stride + x] = ((U16*)pixels)[cy * pixelStride + cx];
-          break;
-        case 32:
-          ((U32*)data)[y * stride + x] = ((U32*)pixels)[cy * pixelStride + cx];
-          break;
-        }
-      }
-    }
+    copy(data, src, mask, offset.x, w);
+    data += stride * bytesPerPixel;
+    src += pixelStride * bytesPerPixel;
     mask += maskStride;
   }
 }
@@ -195,29 +436,38 @@ void FullFramePixelBuffer::maskRect(const Rect& r, Pixel pixel, const void* mask
   U8* mask = (U8*) mask_;
   int w = cr.width();
   int h = cr.height();
-  int bpp = getPF().bpp;
+  int bytesPerPixel = getPF().bpp/8;
   int maskStride = (r.width() + 7) / 8;
 
   Point offset = Point(cr.tl.x-r.tl.x, cr.tl.y-r.tl.y);
   mask += offset.y * maskStride;
+
+  // Whole bytes of mask which are set are gathered into runs and filled in
+  // one go, and those which are clear are skipped.
+  FillRowFn fill = fillRow[bytesPerPixel];
   for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
+    U8* row = data + y * stride * bytesPerPixel;
+    int x = 0;
+    while (x < w) {
       int cx = offset.x + x;
-      U8* byte = mask + (cx / 8);
-      int bit = 7 - cx % 8;
-      if ((*byte) & (1 << bit)) {
-        switch (bpp) {
-        case 8:
-          ((U8*)data)[y * stride + x] = pixel;
-          break;
-        case 16:
-          ((U16*)data)[y * stride + x] = pixel;
-          break;
-        case 32:
-          ((U32*)data)[y * stride + x] = pixel;
-          break;
+      U8 byte = mask[cx / 8];
+      if (cx % 8 == 0 && x + 8 <= w && (byte == 0 || byte == 0xff)) {
+        int run = 8;
+        while (x + run + 8 <= w && mask[cx / 8 + run / 8] == byte)
+          run += 8;
+        if (byte)
+          fill(row + x * bytesPerPixel, pixel, run);
+        x += run;
+        continue;
+      }
+      if (byte & (0x80 >> (cx % 8))) {
+        switch (bytesPerPixel) {
+        case 1: ((U8*)row)[x] = pixel; break;
+        case 2: ((U16*)row)[x] = pixel; break;
+        case 4: ((U32*)row)[x] = pixel; break;
         }
       }
+      x++;
     }
     mask += maskStride;
   }
@@ -232,7 +482,11 @@ void FullFramePixelBuffer::copyRect(const Rect &rect, const Point &move_by_delta
   bytesPerPixel = getPF().bpp/8;
   bytesPerRow = stride * bytesPerPixel;
   bytesPerMemCpy = rect.width() * bytesPerPixel;
-  if (move_by_delta.y <= 0) {
+  if (rect.width() == stride && move_by_delta.x == 0) {
+    // Whole rows form one block, which memmove copies in either direction
+    memmove(data + rect.tl.y*bytesPerRow, data + srect.tl.y*bytesPerRow,
+            bytesPerRow * rect.height());
+  } else if (move_by_delta.y <= 0) {
     U8* dest = data + rect.tl.x*bytesPerPixel + rect.tl.y*bytesPerRow;
     U8* src = data + srect.tl.x*bytesPerPixel + srect.tl.y*bytesPerRow;
     for (int i=rect.tl.y; i<rect.br.y; i++) {
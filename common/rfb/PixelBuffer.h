@@ -135,6 +135,10 @@ namespace rfb {
     //   pixel is the Pixel value to be used where mask_ is set
     virtual void maskRect(const Rect& r, Pixel pixel, const void* mask_);
 
+    // setData() points the buffer at a different block of pixel data of the
+    // same size and format, such as when swapping double buffers.
+    void setData(rdr::U8* data_) { data = data_; }
+
     // *** Should this be visible?
     rdr::U8* data;
 
@@ -167,6 +171,28 @@ namespace rfb {
     void checkDataSize();
   };
 
+  // -=- Pixel kernels
+  //
+  // The row loops behind FullFramePixelBuffer's fillRect() and maskRect().
+  // fillRow() sets n pixels to pix.  maskRow() copies those of n pixels whose
+  // bits are set in the mask, starting at bit x of the mask row.
+  // pixelKernels() lists every version compiled in which the processor can
+  // run, ending with a null name.  The plain C versions come first and the
+  // widest last, and either function may be null if a version lacks it.
+
+  typedef void (*FillRowFn)(rdr::U8* dst, Pixel pix, int n);
+  typedef void (*MaskRowFn)(rdr::U8* dst, const rdr::U8* src,
+                            const rdr::U8* mask, int x, int n);
+
+  struct PixelKernel {
+    const char* name;
+    int bytesPerPixel;
+    FillRowFn fillRow;
+    MaskRowFn maskRow;
+  };
+
+  const PixelKernel* pixelKernels();
+
 };
 
 #endif // __RFB_PIXEL_BUFFER_H__
@@ -41,6 +41,19 @@ void RawDecoder::readRect(const Rect& r, CMsgHandler* handler)
   int y = r.tl.y;
   int w = r.width();
   int h = r.height();
+
+  // Read straight into the framebuffer if the handler lets us
+  int stride;
+  rdr::U8* pixels = handler->getRawPixelsRW(r, &stride);
+  if (pixels) {
+    int bytesPerPixel = reader->bpp() / 8;
+    for (int i = 0; i < h; i++)
+      reader->getInStream()->readBytes(pixels + i * stride * bytesPerPixel,
+                                       w * bytesPerPixel);
+    handler->releaseRawPixels(r);
+    return;
+  }
+
   int nPixels;
   rdr::U8* imageBuf = reader->getImageBuf(w, w*h, &nPixels);
   int bytesPerRow = w * (reader->bpp() / 8);
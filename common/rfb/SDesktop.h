@@ -70,6 +70,12 @@ namespace rfb {
 
     virtual void framebufferUpdateRequest() {}
 
+    // inputFlush() is called after a batch of input events from a client has
+    // been passed on, so that desktops which queue up the events they inject
+    // can send them all at once.
+
+    virtual void inputFlush() {}
+
     // getFbSize() returns the current dimensions of the framebuffer.
     // This can be called even while the SDesktop is not start()ed.
 
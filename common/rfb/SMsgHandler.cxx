@@ -39,8 +39,11 @@ void SMsgHandler::setPixelFormat(const PixelFormat& pf)
 
 void SMsgHandler::setEncodings(int nEncodings, rdr::U32* encodings)
 {
+  int oldScalePercent = cp.scalePercent;
   cp.setEncodings(nEncodings, encodings);
   supportsLocalCursor();
+  if (cp.scalePercent != oldScalePercent)
+    setScalePercent();
 }
 
 void SMsgHandler::framebufferUpdateRequest(const Rect& r, bool incremental)
@@ -50,3 +53,7 @@ void SMsgHandler::framebufferUpdateRequest(const Rect& r, bool incremental)
 void SMsgHandler::supportsLocalCursor()
 {
 }
+
+void SMsgHandler::setScalePercent()
+{
+}
@@ -56,6 +56,10 @@ namespace rfb {
     // specially for this purpose.
     virtual void supportsLocalCursor();
 
+    // setScalePercent() is called whenever cp.scalePercent has changed, which
+    // happens on a setEncodings message.
+    virtual void setScalePercent();
+
     ConnParams cp;
   };
 }
@@ -17,6 +17,7 @@
  */
 #include <stdio.h>
 #include <assert.h>
+#include <algorithm>
 #include <rdr/OutStream.h>
 #include <rfb/msgTypes.h>
 #include <rfb/ColourMap.h>
@@ -24,6 +25,7 @@
 #include <rfb/UpdateTracker.h>
 #include <rfb/SMsgWriter.h>
 #include <rfb/LogWriter.h>
+#include <rfb/Timer.h>
 
 using namespace rfb;
 
@@ -32,7 +34,8 @@ static LogWriter vlog("SMsgWriter");
 SMsgWriter::SMsgWriter(ConnParams* cp_, rdr::OutStream* os_)
   : imageBufIdealSize(0), cp(cp_), os(os_), lenBeforeRect(0),
     currentEncoding(0), updatesSent(0), rawBytesEquivalent(0),
-    imageBuf(0), imageBufSize(0)
+    encodeTime(0), pixelsWritten(0), compressLevel(-1), planned(false),
+    truncated(false), focusSplit(false), imageBuf(0), imageBufSize(0)
 {
   for (unsigned int i = 0; i <= encodingMax; i++) {
     encoders[i] = 0;
@@ -55,6 +58,10 @@ SMsgWriter::~SMsgWriter()
   }
   vlog.info("  raw bytes equivalent %d, compression ratio %f",
           rawBytesEquivalent, (double)rawBytesEquivalent / bytes);
+  if (updatesSent)
+    vlog.info("  bytes per update %d, encode time %.3fs (%.2fms per update)",
+              bytes / updatesSent, encodeTime,
+              encodeTime * 1000 / updatesSent);
   delete [] imageBuf;
 }
 
@@ -93,34 +100,305 @@ void SMsgWriter::writeServerCutText(const char* str, int len)
 void SMsgWriter::writeFramebufferUpdate(const UpdateInfo& ui, ImageGetter* ig,
                                         Region* updatedRegion)
 {
-  writeFramebufferUpdateStart(ui.numRects());
+  writeFramebufferUpdateStart(planRects(ui));
   writeRects(ui, ig, updatedRegion);
   writeFramebufferUpdateEnd();
 }
 
+struct DeferredFirst {
+  DeferredFirst(const Region& r) : deferred(r) {}
+  template<class T> bool operator()(const T& a) const {
+    return !deferred.intersect(a.r).is_empty();
+  }
+  const Region& deferred;
+};
+
+int SMsgWriter::planRects(const UpdateInfo& ui, int maxPixels,
+                          const Point* focus)
+{
+  std::vector<Rect> rects;
+  plan.clear();
+
+  // Any hinted parts of the changed region are planned separately, each with
+  // the encoding best suited to what was drawn there.
+  if (ui.has_hints()) {
+    ui.unhinted().get_rects(&rects);
+    coalesceRects(rects, cp->currentEncoding());
+    for (int h = 0; h < numContentHints; h++) {
+      if (ui.hinted[h].is_empty()) continue;
+      ui.hinted[h].get_rects(&rects);
+      coalesceRects(rects, encodingForHint((ContentHint)h));
+    }
+  } else {
+    ui.changed.get_rects(&rects);
+    coalesceRects(rects, cp->currentEncoding());
+  }
+  planned = true;
+  truncated = false;
+
+  int nearPixels = focus ? focusRects(*focus) : 0;
+  if (nearPixels) {
+    if (!maxPixels || nearPixels < maxPixels)
+      maxPixels = nearPixels;
+  } else if (!deferred.is_empty()) {
+    // Whatever was left out of the last update goes first, so that a part
+    // of the screen which keeps changing can't hold back the rest for good.
+    std::stable_partition(plan.begin(), plan.end(), DeferredFirst(deferred));
+  }
+
+  // If there is a limit on the number of pixels, leave out whatever is beyond
+  // it.  A rectangle which straddles the limit is cut down to whole rows, but
+  // always has at least one so that every update makes progress.
+  if (maxPixels > 0) {
+    int pixels = 0;
+    std::vector<PlannedRect>::iterator i;
+    for (i = plan.begin(); i != plan.end() && pixels < maxPixels; i++) {
+      int area = i->r.area();
+      if (pixels + area > maxPixels) {
+        int rows = __rfbmax(1, (maxPixels - pixels) / i->r.width());
+        if (rows < i->r.height()) {
+          i->r.br.y = i->r.tl.y + rows;
+          truncated = true;
+        }
+        area = i->r.area();
+      }
+      pixels += area;
+    }
+    if (i != plan.end()) {
+      plan.erase(i, plan.end());
+      truncated = true;
+    }
+  }
+
+  deferred.clear();
+  if (truncated) {
+    Region sent;
+    std::vector<PlannedRect>::const_iterator i;
+    for (i = plan.begin(); i != plan.end(); i++)
+      sent.assign_union(i->r);
+    deferred = ui.changed.subtract(sent);
+  }
+
+  int nRects = plan.size();
+  CopyList::const_iterator op;
+  for (op = ui.copies.begin(); op != ui.copies.end(); op++)
+    nRects += op->dest.numRects();
+  return nRects;
+}
+
+bool SMsgWriter::planOverlaps(const Rect& r)
+{
+  std::vector<PlannedRect>::const_iterator i;
+  for (i = plan.begin(); i != plan.end(); i++)
+    if (i->r.overlaps(r)) return true;
+  return false;
+}
+
+// Merging a rectangle into another saves the overhead of sending it
+// separately, but costs sending whatever pixels lie between them.
+// rectOverhead() estimates the first in bytes, from the rectangle header
+// plus, for ZRLE, the length field and the zlib flush at the end of each
+// rectangle.  pixelCost() estimates the second in sixteenths of a byte per
+// pixel, from typical compression ratios for each encoding.  Merging is only
+// tried with the last COALESCE_WINDOW planned rectangles, and never where the
+// result would overlap another of them.
+
+#define COALESCE_WINDOW 8
+
+static int rectOverhead(unsigned int encoding)
+{
+  if (encoding == encodingZRLE)
+    return 12 + 4 + 16;
+  return 12;
+}
+
+static int pixelCost(unsigned int encoding, int bpp)
+{
+  switch (encoding) {
+  case encodingRaw:     return bpp * 2;
+  case encodingZRLE:    return bpp / 4;
+  default:              return bpp;
+  }
+}
+
+void SMsgWriter::coalesceRects(const std::vector<Rect>& rects,
+                               unsigned int encoding)
+{
+  int maxExtra = rectOverhead(encoding) * 16 / pixelCost(encoding, bpp());
+  int first = plan.size();
+  std::vector<int> covered;
+
+  std::vector<Rect>::const_iterator i;
+  for (i = rects.begin(); i != rects.end(); i++) {
+    int start = __rfbmax(first, (int)plan.size() - COALESCE_WINDOW);
+    int best = -1;
+    int bestExtra = maxExtra;
+    Rect bestRect;
+
+    for (int j = start; j < (int)plan.size(); j++) {
+      Rect merged = plan[j].r.union_boundary(*i);
+      int extra = (int)merged.area() - covered[j - first] - (int)i->area();
+      if (extra >= bestExtra) continue;
+      int k;
+      for (k = start; k < (int)plan.size(); k++)
+        if (k != j && merged.overlaps(plan[k].r)) break;
+      if (k < (int)plan.size()) continue;
+      best = j;
+      bestExtra = extra;
+      bestRect = merged;
+    }
+
+    if (best >= 0) {
+      plan[best].r = bestRect;
+      covered[best - first] += i->area();
+    } else {
+      plan.push_back(PlannedRect(*i, encoding));
+      covered.push_back(i->area());
+    }
+  }
+}
+
+// focusRects() reorders the plan to cut the latency the user sees around the
+// focus point.  Rectangles are put in bands by their distance from the point,
+// FOCUS_BAND pixels wide, nearest band first and smallest first within each
+// band.  If the nearest band is small compared with the rest, it returns the
+// number of pixels in it, so that it can go in an update of its own and the
+// rest follow in the next one.  Otherwise it returns 0.
+
+#define FOCUS_BAND 128
+#define FOCUS_SPLIT_PIXELS (64*64*4)
+
+static int focusBand(const Rect& r, const Point& p)
+{
+  int dx = __rfbmax(__rfbmax(r.tl.x - p.x, p.x - (r.br.x - 1)), 0);
+  int dy = __rfbmax(__rfbmax(r.tl.y - p.y, p.y - (r.br.y - 1)), 0);
+  return __rfbmax(dx, dy) / FOCUS_BAND;
+}
+
+struct FocusOrder {
+  FocusOrder(const Point& p) : focus(p) {}
+  template<class T> bool operator()(const T& a, const T& b) const {
+    int bandA = focusBand(a.r, focus);
+    int bandB = focusBand(b.r, focus);
+    if (bandA != bandB)
+      return bandA < bandB;
+    return a.r.area() < b.r.area();
+  }
+  Point focus;
+};
+
+int SMsgWriter::focusRects(const Point& focus)
+{
+  std::stable_sort(plan.begin(), plan.end(), FocusOrder(focus));
+
+  int nearPixels = 0, farPixels = 0;
+  std::vector<PlannedRect>::const_iterator i;
+  for (i = plan.begin(); i != plan.end(); i++) {
+    if (focusBand(i->r, focus) == 0)
+      nearPixels += i->r.area();
+    else
+      farPixels += i->r.area();
+  }
+
+  // Two updates running are never split, otherwise changes near a moving
+  // pointer, such as the cursor itself, would hold back the rest for as long
+  // as it moved.
+  bool split = (!focusSplit && nearPixels &&
+                farPixels >= __rfbmax(nearPixels, FOCUS_SPLIT_PIXELS));
+  focusSplit = split;
+  return split ? nearPixels : 0;
+}
+
+// writeRects() writes the rectangles worked out by planRects().  Unless there
+// was a focus point these come grouped by encoding and, within each group,
+// from top to bottom, which keeps similar content together in the encoders'
+// zlib streams.
+
 void SMsgWriter::writeRects(const UpdateInfo& ui, ImageGetter* ig,
-                            Region* updatedRegion)
+                            Region* updatedRegion, Region* encodedRegion)
 {
   std::vector<Rect> rects;
   std::vector<Rect>::const_iterator i;
   updatedRegion->copyFrom(ui.changed);
-  updatedRegion->assign_union(ui.copied);
 
-  ui.copied.get_rects(&rects, ui.copy_delta.x <= 0, ui.copy_delta.y <= 0);
-  for (i = rects.begin(); i != rects.end(); i++)
-    writeCopyRect(*i, i->tl.x - ui.copy_delta.x, i->tl.y - ui.copy_delta.y);
+  if (!planned)
+    planRects(ui);
 
-  ui.changed.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++) {
+  // If the plan doesn't cover all of the changed region then the rest has
+  // not been sent.
+  updatedRegion->assign_subtract(deferred);
+
+  timeval start;
+  Timer::getTime(&start);
+
+  // The copies are written in the order they happened, since a later one
+  // may take its source from the destination of an earlier one.
+  CopyList::const_iterator op;
+  for (op = ui.copies.begin(); op != ui.copies.end(); op++) {
+    updatedRegion->assign_union(op->dest);
+    op->dest.get_rects(&rects, op->delta.x <= 0, op->delta.y <= 0);
+    for (i = rects.begin(); i != rects.end(); i++)
+      writeCopyRect(*i, i->tl.x - op->delta.x, i->tl.y - op->delta.y);
+  }
+
+  if (encodedRegion)
+    encodedRegion->clear();
+  std::vector<PlannedRect>::const_iterator p;
+  for (p = plan.begin(); p != plan.end(); p++) {
     Rect actual;
-    if (!writeRect(*i, ig, &actual)) {
-      updatedRegion->assign_subtract(*i);
+    if (!writeRect(p->r, p->encoding, ig, &actual)) {
+      updatedRegion->assign_subtract(p->r);
       updatedRegion->assign_union(actual);
+      pixelsWritten += actual.area();
+    } else {
+      actual = p->r;
+      pixelsWritten += p->r.area();
     }
+    if (encodedRegion)
+      encodedRegion->assign_union(actual);
   }
+  plan.clear();
+  planned = false;
+
+  encodeTime += Timer::usSince(start) / 1000000.0;
+}
+
+unsigned int SMsgWriter::encodingForHint(ContentHint hint)
+{
+  unsigned int current = cp->currentEncoding();
+  // A client which asks for raw wants its pixels sent as they are, most
+  // likely because it is on a fast link where encoding would only cost time.
+  if (current == encodingRaw)
+    return current;
+  switch (hint) {
+  case hintFill:
+    if (cp->supportsEncoding(encodingRRE))
+      return encodingRRE;
+    break;
+  case hintText:
+    if (cp->supportsEncoding(encodingZRLE))
+      return encodingZRLE;
+    if (cp->supportsEncoding(encodingHextile))
+      return encodingHextile;
+    break;
+  case hintImage:
+    if (cp->supportsEncoding(encodingZRLE))
+      return encodingZRLE;
+    break;
+  default:
+    break;
+  }
+  return current;
 }
 
 
+int SMsgWriter::getCompressLevel()
+{
+  if (cp->compressLevel >= 0)
+    return cp->compressLevel;
+  return compressLevel;
+}
+
 bool SMsgWriter::needFakeUpdate()
 {
   return false;
@@ -22,9 +22,11 @@
 #ifndef __RFB_SMSGWRITER_H__
 #define __RFB_SMSGWRITER_H__
 
+#include <vector>
 #include <rdr/types.h>
 #include <rfb/encodings.h>
 #include <rfb/Encoder.h>
+#include <rfb/UpdateTracker.h>
 
 namespace rdr { class OutStream; }
 
@@ -66,6 +68,11 @@ namespace rfb {
     // but will write the relevant pseudo-rectangle as part of the next update.
     virtual bool writeSetDesktopSize()=0;
 
+    // writeSetCursorPos() likewise writes a pseudo-rectangle giving the new
+    // cursor position as part of the next update.  It returns false if the
+    // client does not support this.
+    virtual bool writeSetCursorPos(const Point& pos)=0;
+
     // Like setDestkopSize, we can't just write out a setCursor message
     // immediately on a V3 writer.  Instead of calling writeSetCursor()
     // directly, you must call cursorChange(), and then invoke writeSetCursor()
@@ -76,8 +83,8 @@ namespace rfb {
                                 void* data, void* mask)=0;
 
     // needFakeUpdate() returns true when an immediate update is needed in
-    // order to flush out setDesktopSize or setCursor pseudo-rectangles to the
-    // client.
+    // order to flush out setDesktopSize, setCursor or setCursorPos
+    // pseudo-rectangles to the client.
     virtual bool needFakeUpdate();
 
     // writeFramebufferUpdate() writes a framebuffer update using the given
@@ -87,14 +94,33 @@ namespace rfb {
     virtual void writeFramebufferUpdate(const UpdateInfo& ui, ImageGetter* ig,
                                         Region* updatedRegion);
 
-    // writeRects() accepts an UpdateInfo (changed & copied regions) and an
+    // planRects() works out the rectangles to send for the given update and
+    // returns how many there are, including copies.  Hinted parts of the
+    // changed region are planned separately, using the encoding given by
+    // encodingForHint().  Nearby rectangles are merged where the estimated
+    // cost of sending the pixels between them is less than the overhead of a
+    // separate rectangle.  If maxPixels is non-zero then the plan stops after
+    // that many pixels, and the rest of the changed region is left out of the
+    // updated region returned by writeRects() and planned first next time.
+    // If a focus point is given, such as the client's pointer, then
+    // rectangles near it are planned first and, if there is a lot more
+    // elsewhere and the last plan was not split this way, on their own.
+    // planOverlaps() says whether any of the planned rectangles overlaps the
+    // given one.
+    int planRects(const UpdateInfo& ui, int maxPixels=0, const Point* focus=0);
+    bool planOverlaps(const Rect& r);
+
+    // writeRects() accepts an UpdateInfo (changed region & copies) and an
     // ImageGetter to fetch pixels from.  It then calls writeCopyRect() and
-    // writeRect() as appropriate.  writeFramebufferUpdateStart() must be used
-    // before the first writeRects() call and writeFrameBufferUpdateEnd() after
-    // the last one.  It returns the actual region sent to the client, which
-    // may be smaller than the update passed in.
+    // writeRect() as appropriate for the rectangles planned by planRects(),
+    // which it calls itself if need be.  writeFramebufferUpdateStart() must be
+    // used before the first writeRects() call and writeFrameBufferUpdateEnd()
+    // after the last one.  It returns the actual region sent to the client,
+    // which may be smaller than the update passed in.  If encodedRegion is
+    // given then it is set to the pixels sent with writeRect(), which take in
+    // any unchanged pixels between rectangles merged by planRects().
     virtual void writeRects(const UpdateInfo& update, ImageGetter* ig,
-                            Region* updatedRegion);
+                            Region* updatedRegion, Region* encodedRegion=0);
 
     // To construct a framebuffer update you can call
     // writeFramebufferUpdateStart(), followed by a number of writeCopyRect()s
@@ -114,6 +140,14 @@ namespace rfb {
 
     virtual void writeCopyRect(const Rect& r, int srcX, int srcY);
 
+    // encodingForHint() returns the encoding to use for an area drawn by the
+    // given kind of operation.  Solid fills go as RRE, which sends a solid
+    // rectangle as just its colour, and text and images as ZRLE, whose palette
+    // tiles suit text and whose zlib stream compresses images best.  Text
+    // falls back to hextile.  If the client supports none of these, or its
+    // current encoding is raw, the current encoding is used.
+    unsigned int encodingForHint(ContentHint hint);
+
     virtual void startRect(const Rect& r, unsigned int enc)=0;
     virtual void endRect()=0;
 
@@ -126,6 +160,20 @@ namespace rfb {
     int getRectsSent(int encoding) { return rectsSent[encoding]; }
     int getBytesSent(int encoding) { return bytesSent[encoding]; }
     int getRawBytesEquivalent()    { return rawBytesEquivalent; }
+    double getEncodeTime()         { return encodeTime; }
+
+    // getEncodeRate() returns the number of pixels per second written by
+    // writeRects() so far, including time spent waiting to write them, or 0
+    // if nothing has been written yet.
+    double getEncodeRate() {
+      return encodeTime > 0 ? pixelsWritten / encodeTime : 0;
+    }
+
+    // getCompressLevel() returns the zlib compression level for encoders to
+    // use.  This is the level the client asked for if there is one, otherwise
+    // the level given to setCompressLevel(), where -1 means the default.
+    int getCompressLevel();
+    void setCompressLevel(int level) { compressLevel = level; }
 
     int imageBufIdealSize;
 
@@ -135,6 +183,17 @@ namespace rfb {
     virtual void startMsg(int type)=0;
     virtual void endMsg()=0;
 
+    // PlannedRect is a rectangle of the changed region, or several merged
+    // together, and the encoding to send it with.
+    struct PlannedRect {
+      PlannedRect(const Rect& r_, unsigned int e) : r(r_), encoding(e) {}
+      Rect r;
+      unsigned int encoding;
+    };
+
+    void coalesceRects(const std::vector<Rect>& rects, unsigned int encoding);
+    int focusRects(const Point& focus);
+
     ConnParams* cp;
     rdr::OutStream* os;
 
@@ -145,6 +204,15 @@ namespace rfb {
     int bytesSent[encodingMax+1];
     int rectsSent[encodingMax+1];
     int rawBytesEquivalent;
+    double encodeTime;
+    double pixelsWritten;
+    int compressLevel;
+
+    std::vector<PlannedRect> plan;
+    bool planned;
+    bool truncated;
+    bool focusSplit;
+    Region deferred;
 
     rdr::U8* imageBuf;
     int imageBufSize;
@@ -27,7 +27,7 @@ using namespace rfb;
 SMsgWriterV3::SMsgWriterV3(ConnParams* cp, rdr::OutStream* os)
   : SMsgWriter(cp, os), updateOS(0), realOS(os), nRectsInUpdate(0),
     nRectsInHeader(0), wsccb(0),
-    needSetDesktopSize(false)
+    needSetDesktopSize(false), needSetCursorPos(false)
 {
 }
 
@@ -64,6 +64,13 @@ bool SMsgWriterV3::writeSetDesktopSize() {
   return true;
 }
 
+bool SMsgWriterV3::writeSetCursorPos(const Point& pos) {
+  if (!cp->supportsCursorPos) return false;
+  needSetCursorPos = true;
+  cursorPos = pos;
+  return true;
+}
+
 void SMsgWriterV3::cursorChange(WriteSetCursorCallback* cb)
 {
   wsccb = cb;
@@ -90,6 +97,7 @@ void SMsgWriterV3::writeFramebufferUpdateStart(int nRects)
   os->pad(1);
   if (wsccb) nRects++;
   if (needSetDesktopSize) nRects++;
+  if (needSetCursorPos) nRects++;
   os->writeU16(nRects);
   nRectsInUpdate = 0;
   nRectsInHeader = nRects;
@@ -122,6 +130,17 @@ void SMsgWriterV3::writeFramebufferUpdateEnd()
     needSetDesktopSize = false;
   }
 
+  if (needSetCursorPos) {
+    if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
+      throw Exception("SMsgWriterV3 setCursorPos: nRects out of sync");
+    os->writeU16(cursorPos.x);
+    os->writeU16(cursorPos.y);
+    os->writeU16(0);
+    os->writeU16(0);
+    os->writeU32(pseudoEncodingCursorPos);
+    needSetCursorPos = false;
+  }
+
   if (nRectsInUpdate != nRectsInHeader && nRectsInHeader)
     throw Exception("SMsgWriterV3::writeFramebufferUpdateEnd: "
                     "nRects out of sync");
@@ -140,7 +159,7 @@ void SMsgWriterV3::writeFramebufferUpdateEnd()
 
 bool SMsgWriterV3::needFakeUpdate()
 {
-  return wsccb || needSetDesktopSize;
+  return wsccb || needSetDesktopSize || needSetCursorPos;
 }
 
 void SMsgWriterV3::startRect(const Rect& r, unsigned int encoding)
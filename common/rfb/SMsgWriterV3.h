@@ -32,6 +32,7 @@ namespace rfb {
     virtual void startMsg(int type);
     virtual void endMsg();
     virtual bool writeSetDesktopSize();
+    virtual bool writeSetCursorPos(const Point& pos);
     virtual void cursorChange(WriteSetCursorCallback* cb);
     virtual void writeSetCursor(int width, int height, const Point& hotspot,
                                 void* data, void* mask);
@@ -49,6 +50,8 @@ namespace rfb {
     int nRectsInHeader;
     WriteSetCursorCallback* wsccb;
     bool needSetDesktopSize;
+    bool needSetCursorPos;
+    Point cursorPos;
   };
 }
 #endif
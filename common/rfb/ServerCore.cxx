@@ -39,6 +39,41 @@ rfb::BoolParameter rfb::Server::compareFB
 ("CompareFB",
  "Perform pixel comparison on framebuffer to reduce unnecessary updates",
  true);
+rfb::BoolParameter rfb::Server::findSolidAreas
+("FindSolidAreas",
+ "Look for large areas of a single colour and send each as one rectangle",
+ true);
+rfb::BoolParameter rfb::Server::adaptCompressLevel
+("AdaptCompressLevel",
+ "Adjust the zlib compression level of each connection to suit its speed, "
+ "unless the client asks for a particular level",
+ true);
+rfb::IntParameter rfb::Server::maxUpdateTime
+("MaxUpdateTime",
+ "The number of milliseconds to aim to spend on any one update to a client. "
+ "Anything more is left for the client's next update, so that other clients "
+ "and input are not held up (zero means no limit)",
+ 50, 0);
+rfb::IntParameter rfb::Server::viewOnlyUpdateTime
+("ViewOnlyUpdateTime",
+ "As MaxUpdateTime, but for clients which may not send keyboard or pointer "
+ "events",
+ 20, 0);
+rfb::BoolParameter rfb::Server::pointerFirst
+("PointerFirst",
+ "Send the changes near a client's pointer, smallest first, ahead of the "
+ "rest while the pointer is in use",
+ true);
+rfb::BoolParameter rfb::Server::progressiveUpdates
+("ProgressiveUpdates",
+ "Send large updates which would take too long in reduced colour first, and "
+ "send them again in full colour when there is nothing else to send",
+ false);
+rfb::BoolParameter rfb::Server::allowScaling
+("AllowScaling",
+ "Scale the framebuffer down before sending it to clients which ask for it "
+ "to be smaller",
+ true);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
@@ -35,6 +35,13 @@ namespace rfb {
     static IntParameter idleTimeout;
     static IntParameter clientWaitTimeMillis;
     static BoolParameter compareFB;
+    static BoolParameter findSolidAreas;
+    static BoolParameter adaptCompressLevel;
+    static IntParameter maxUpdateTime;
+    static IntParameter viewOnlyUpdateTime;
+    static BoolParameter pointerFirst;
+    static BoolParameter progressiveUpdates;
+    static BoolParameter allowScaling;
     static BoolParameter protocol3_3;
     static BoolParameter alwaysShared;
     static BoolParameter neverShared;
@@ -130,6 +130,16 @@ int Timer::getNextTimeout() {
   return toWait;
 }
 
+void Timer::getTime(timeval* tv) {
+  gettimeofday(tv, 0);
+}
+
+int Timer::usSince(const timeval& then) {
+  timeval now;
+  gettimeofday(&now, 0);
+  return ((now.tv_sec - then.tv_sec) * 1000000) + (now.tv_usec - then.tv_usec);
+}
+
 void Timer::insertTimer(Timer* t) {
   std::list<Timer*>::iterator i;
   for (i=pending.begin(); i!=pending.end(); i++) {
@@ -61,6 +61,15 @@ namespace rfb {
     //   any elapsed Timers.
     static int getNextTimeout();
 
+    // getTime()
+    //   Gets the current time, using the same clock as the Timer code.
+    static void getTime(timeval* tv);
+
+    // usSince()
+    //   Returns the number of microseconds elapsed since a time got from
+    //   getTime().  Only suitable for measuring short intervals.
+    static int usSince(const timeval& then);
+
     // Create a Timer with the specified callback handler
     Timer(Callback* cb_) {cb = cb_;}
     ~Timer() {stop();}
@@ -90,6 +90,17 @@ static void noTransFn(void* table_,
 #undef BPPOUT
 
 
+template<class T>
+static void reduceImage(T* ptr, T mask, int stride, int width, int height)
+{
+  while (height > 0) {
+    for (int i = 0; i < width; i++)
+      ptr[i] &= mask;
+    ptr += stride;
+    height--;
+  }
+}
+
 // Translation functions.  Note that transSimple* is only used for 8/16bpp and
 // transRGB* is used for 16/32bpp
 
@@ -144,7 +155,7 @@ static initTCtoCubeFnType initRGBTCtoCubeFns[] = {
 
 
 TransImageGetter::TransImageGetter(bool econ)
-  : economic(econ), pb(0), table(0), transFn(0), cube(0)
+  : economic(econ), pb(0), table(0), transFn(0), cube(0), reduceMask(0)
 {
 }
 
@@ -160,6 +171,7 @@ void TransImageGetter::init(PixelBuffer* pb_, const PixelFormat& out,
   outPF = out;
   transFn = 0;
   cube = cube_;
+  reduceMask = 0;
   const PixelFormat& inPF = pb->getPF();
 
   if ((inPF.bpp != 8) && (inPF.bpp != 16) && (inPF.bpp != 32))
@@ -268,6 +280,41 @@ void TransImageGetter::getImage(void* outPtr, const Rect& r, int outStride)
 
   (*transFn)(table, pb->getPF(), (void*)inPtr, inStride,
              outPF, outPtr, outStride, r.width(), r.height());
+
+  if (reduceMask) {
+    if (outPF.bpp == 16)
+      reduceImage((rdr::U16*)outPtr, (rdr::U16)reduceMask, outStride,
+                  r.width(), r.height());
+    else
+      reduceImage((rdr::U32*)outPtr, (rdr::U32)reduceMask, outStride,
+                  r.width(), r.height());
+  }
+}
+
+// The reduced colour mask keeps the top three bits of red and green and the
+// top two of blue, like the bgr233 format used for 8bpp clients.  It is kept
+// in the byte order of the client's pixels so that it can be applied to them
+// directly.
+
+static Pixel topBits(int max, int shift, int bits)
+{
+  int drop = 0;
+  while ((max >> drop) >= (1 << bits)) drop++;
+  return (Pixel)((max >> drop) << drop) << shift;
+}
+
+void TransImageGetter::setReducedColour(bool reduce)
+{
+  reduceMask = 0;
+  if (!reduce || !outPF.trueColour || outPF.bpp == 8)
+    return;
+
+  Pixel mask = (topBits(outPF.redMax,   outPF.redShift,   3) |
+                topBits(outPF.greenMax, outPF.greenShift, 3) |
+                topBits(outPF.blueMax,  outPF.blueShift,  2));
+  if (outPF.bigEndian != nativeBigEndian)
+    mask = (outPF.bpp == 16) ? SWAP16(mask) : SWAP32(mask);
+  reduceMask = mask;
 }
 
 void TransImageGetter::translatePixels(void* inPtr, void* outPtr,
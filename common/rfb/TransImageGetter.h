@@ -91,6 +91,15 @@ namespace rfb {
     // the rectangle given to getImage().
     void setOffset(const Point& offset_) { offset = offset_; }
 
+    // setReducedColour() turns on or off a mode in which getImage() keeps only
+    // the top few bits of each colour component, about as many as an 8bpp
+    // pixel format would.  The result compresses much better, at the cost of
+    // accuracy, so it can be used for a quick first version of a large area
+    // which is refined later.  It has no effect unless the client's pixel
+    // format is true colour with more than 8 bits per pixel.
+    void setReducedColour(bool reduce);
+    bool reducingColour() const { return reduceMask != 0; }
+
   private:
     bool economic;
     PixelBuffer* pb;
@@ -99,6 +108,7 @@ namespace rfb {
     transFnType transFn;
     ColourCube* cube;
     Point offset;
+    Pixel reduceMask;
   };
 }
 #endif
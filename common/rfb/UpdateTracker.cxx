@@ -30,6 +30,9 @@ using namespace rfb;
 
 static LogWriter vlog("UpdateTracker");
 
+// The most copies we track at once.  Any further copy is treated as a change.
+#define MAX_COPIES 16
+
 
 // -=- ClippingUpdateTracker
 
@@ -37,6 +40,10 @@ void ClippingUpdateTracker::add_changed(const Region &region) {
   ut->add_changed(region.intersect(clipRect));
 }
 
+void ClippingUpdateTracker::add_hint(const Region &region, ContentHint hint) {
+  ut->add_hint(region.intersect(clipRect), hint);
+}
+
 void ClippingUpdateTracker::add_copied(const Region &dest, const Point &delta) {
   // Clip the destination to the display area
   Region clipdest = dest.intersect(clipRect);
@@ -71,14 +78,31 @@ SimpleUpdateTracker::~SimpleUpdateTracker() {
 
 void SimpleUpdateTracker::enable_copyrect(bool enable) {
   if (!enable && copy_enabled) {
-    add_changed(copied);
-    copied.clear();
+    add_changed(get_copied());
+    copies.clear();
   }
   copy_enabled=enable;
 }
 
 void SimpleUpdateTracker::add_changed(const Region &region) {
   changed.assign_union(region);
+  removeFromHints(region);
+}
+
+// add_hint() records what drew part of the changed region.  An area can only
+// have one hint, so the most recent one wins.
+
+void SimpleUpdateTracker::add_hint(const Region &region, ContentHint hint) {
+  Region r = region.intersect(changed);
+  if (r.is_empty()) return;
+  removeFromHints(r);
+  hints[hint].assign_union(r);
+}
+
+void SimpleUpdateTracker::removeFromHints(const Region& region) {
+  for (int h = 0; h < numContentHints; h++)
+    if (!hints[h].is_empty())
+      hints[h].assign_subtract(region);
 }
 
 void SimpleUpdateTracker::add_copied(const Region &dest, const Point &delta) {
@@ -91,66 +115,167 @@ void SimpleUpdateTracker::add_copied(const Region &dest, const Point &delta) {
   // Is there anything to do?
   if (dest.is_empty()) return;
 
-  // Calculate whether any of this copy can be treated as a continuation
-  // of an earlier one
+  // Whatever was drawn at the destination has now been overwritten
+  removeFromHints(dest);
+
+  // Be careful not to copy stuff that still needs to be updated
   Region src = dest;
   src.translate(delta.negate());
-  Region overlap = src.intersect(copied);
-
-  if (overlap.is_empty()) {
-    // There is no overlap
-
-    Rect newbr = dest.get_bounding_rect();
-    Rect oldbr = copied.get_bounding_rect();
-    if (oldbr.area() > newbr.area()) {
-      // Old copyrect is (probably) bigger - use it
-      changed.assign_union(dest);
-    } else {
-      // New copyrect is probably bigger
-      // Use the new one
-      // But be careful not to copy stuff that still needs
-      // to be updated.
-      Region invalid_src = src.intersect(changed);
-      invalid_src.translate(delta);
-      changed.assign_union(invalid_src);
-      changed.assign_union(copied);
-      copied = dest;
-      copy_delta = delta;
-    }
+  Region invalid_src = src.intersect(changed);
+  invalid_src.translate(delta);
+  changed.assign_union(invalid_src);
+
+  // Calculate whether this copy can be treated as a continuation of an
+  // earlier one, as happens when a window is dragged.  Only the most recent
+  // copy whose destination overlaps our source is a candidate.
+  CopyList::iterator i = copies.end();
+  while (i != copies.begin()) {
+    i--;
+    Region overlap = src.intersect(i->dest);
+    if (overlap.is_empty())
+      continue;
+
+    overlap.translate(delta);
+    if (!canCombine(i, overlap))
+      break;
+
+    Region nonoverlapped_copied = dest.union_(i->dest).subtract(overlap);
+    changed.assign_union(nonoverlapped_copied);
+
+    i->dest = overlap;
+    i->delta = i->delta.translate(delta);
     return;
   }
 
-  Region invalid_src = overlap.intersect(changed);
-  invalid_src.translate(delta);
-  changed.assign_union(invalid_src);
-  
-  overlap.translate(delta);
+  if (copies.size() >= MAX_COPIES) {
+    changed.assign_union(dest);
+    return;
+  }
 
-  Region nonoverlapped_copied = dest.union_(copied).subtract(overlap);
-  changed.assign_union(nonoverlapped_copied);
+  copies.push_back(CopyOp(dest, delta));
+}
 
-  copied = overlap;
-  copy_delta = copy_delta.translate(delta);
+// canCombine() returns true if the given copy can be altered to copy straight
+// to newDest, with anything else it used to copy becoming changed.  This is
+// only safe if no later copy takes its source from either the old or the new
+// destination, or overwrites the new destination.
 
-  return;
+bool SimpleUpdateTracker::canCombine(CopyList::iterator op,
+                                     const Region& newDest)
+{
+  Region dests = op->dest.union_(newDest);
+  CopyList::iterator i;
+  for (i = op, i++; i != copies.end(); i++) {
+    Region src = i->dest;
+    src.translate(i->delta.negate());
+    if (!src.intersect(dests).is_empty())
+      return false;
+    if (!i->dest.intersect(newDest).is_empty())
+      return false;
+  }
+  return true;
 }
 
+void SimpleUpdateTracker::removeFromCopies(const Region& region)
+{
+  Region needed;
+  CopyList::iterator i = copies.end();
+  while (i != copies.begin()) {
+    i--;
+    i->dest.assign_subtract(region.subtract(needed));
+    if (i->dest.is_empty()) {
+      i = copies.erase(i);
+      continue;
+    }
+    Region src = i->dest;
+    src.translate(i->delta.negate());
+    needed.assign_union(src);
+  }
+}
+
+// subtract() is used once the client has been sent the given region.  Any
+// copy still pending whose source lies in that region would now copy the new
+// contents rather than the old, so its destination must be treated as
+// changed.  That in turn invalidates any later copy from there.
+
 void SimpleUpdateTracker::subtract(const Region& region) {
-  copied.assign_subtract(region);
+  Region invalid = region;
+  CopyList::iterator i = copies.begin();
+  while (i != copies.end()) {
+    i->dest.assign_subtract(region);
+    if (i->dest.is_empty()) {
+      i = copies.erase(i);
+      continue;
+    }
+    Region invalid_src = i->dest;
+    invalid_src.translate(i->delta.negate());
+    invalid_src.assign_intersect(invalid);
+    if (!invalid_src.is_empty()) {
+      invalid_src.translate(i->delta);
+      changed.assign_union(invalid_src);
+      invalid.assign_union(invalid_src);
+    }
+    i++;
+  }
   changed.assign_subtract(region);
+  removeFromHints(region);
 }
 
+// getUpdateInfo() clips the update to the given region.  A copy can only be
+// sent if the earlier copies it depends on are also sent, so any part of a
+// copy whose source is the unsent destination of an earlier copy is sent as
+// changed instead.
+
 void SimpleUpdateTracker::getUpdateInfo(UpdateInfo* info, const Region& clip)
 {
-  copied.assign_subtract(changed);
+  removeFromCopies(changed);
   info->changed = changed.intersect(clip);
-  info->copied = copied.intersect(clip);
-  info->copy_delta = copy_delta;
+  for (int h = 0; h < numContentHints; h++)
+    info->hinted[h] = hints[h].intersect(clip);
+  info->copies.clear();
+
+  Region unsent;
+  CopyList::const_iterator i;
+  for (i = copies.begin(); i != copies.end(); i++) {
+    Region dest = i->dest.intersect(clip);
+    if (!unsent.is_empty()) {
+      Region dependent = unsent;
+      dependent.translate(i->delta);
+      dependent.assign_intersect(dest);
+      dest.assign_subtract(dependent);
+      info->changed.assign_union(dependent);
+      unsent.assign_union(dependent);
+    }
+    if (!dest.is_empty())
+      info->copies.push_back(CopyOp(dest, i->delta));
+    unsent.assign_union(i->dest.subtract(clip));
+  }
 }
 
 void SimpleUpdateTracker::copyTo(UpdateTracker* to) const {
-  if (!copied.is_empty())
-    to->add_copied(copied, copy_delta);
+  CopyList::const_iterator i;
+  for (i = copies.begin(); i != copies.end(); i++)
+    to->add_copied(i->dest, i->delta);
   if (!changed.is_empty())
     to->add_changed(changed);
+  for (int h = 0; h < numContentHints; h++)
+    if (!hints[h].is_empty())
+      to->add_hint(hints[h], (ContentHint)h);
+}
+
+Region SimpleUpdateTracker::get_copied() const {
+  Region copied;
+  CopyList::const_iterator i;
+  for (i = copies.begin(); i != copies.end(); i++)
+    copied.assign_union(i->dest);
+  return copied;
+}
+
+void SimpleUpdateTracker::translate(const Point& p) {
+  changed.translate(p);
+  for (int h = 0; h < numContentHints; h++)
+    hints[h].translate(p);
+  CopyList::iterator i;
+  for (i = copies.begin(); i != copies.end(); i++)
+    i->dest.translate(p);
 }
@@ -22,19 +22,51 @@
 #include <rfb/Rect.h>
 #include <rfb/Region.h>
 #include <rfb/PixelBuffer.h>
+#include <list>
 
 namespace rfb {
 
+  // CopyOp describes a single copy by its destination region and the offset
+  // from its source to its destination.  A list of copies must be applied in
+  // order, since a later copy may take its source from the destination of an
+  // earlier one.
+
+  struct CopyOp {
+    CopyOp(const Region& d, const Point& p) : dest(d), delta(p) {}
+    Region dest;
+    Point delta;
+  };
+
+  typedef std::list<CopyOp> CopyList;
+
+  // ContentHint says what kind of drawing operation produced a changed area,
+  // where the server knows it.  This lets the encoder layer pick an encoding
+  // suited to the content instead of using the same one for everything.
+
+  enum ContentHint { hintFill, hintText, hintImage, numContentHints };
+
+  // UpdateInfo::hinted[] gives the parts of the changed region known to have
+  // been drawn by each kind of operation.  They are disjoint subsets of
+  // changed.
+
   class UpdateInfo {
   public:
     Region changed;
-    Region copied;
-    Point copy_delta;
+    Region hinted[numContentHints];
+    CopyList copies;
     bool is_empty() const {
-      return copied.is_empty() && changed.is_empty();
+      return copies.empty() && changed.is_empty();
+    }
+    bool has_hints() const {
+      for (int h = 0; h < numContentHints; h++)
+        if (!hinted[h].is_empty()) return true;
+      return false;
     }
-    int numRects() const {
-      return copied.numRects() + changed.numRects();
+    Region unhinted() const {
+      Region r = changed;
+      for (int h = 0; h < numContentHints; h++)
+        if (!hinted[h].is_empty()) r.assign_subtract(hinted[h]);
+      return r;
     }
   };
 
@@ -45,6 +77,11 @@ namespace rfb {
 
     virtual void add_changed(const Region &region) = 0;
     virtual void add_copied(const Region &dest, const Point &delta) = 0;
+
+    // add_hint() says that the given region, which must already have been
+    // passed to add_changed(), was drawn by the given kind of operation.
+    // Trackers which don't care about hints can ignore it.
+    virtual void add_hint(const Region &region, ContentHint hint) {}
   };
 
   class ClippingUpdateTracker : public UpdateTracker {
@@ -57,6 +94,7 @@ namespace rfb {
 
     virtual void add_changed(const Region &region);
     virtual void add_copied(const Region &dest, const Point &delta);
+    virtual void add_hint(const Region &region, ContentHint hint);
   protected:
     UpdateTracker* ut;
     Region clipRect;
@@ -71,6 +109,7 @@ namespace rfb {
 
     virtual void add_changed(const Region &region);
     virtual void add_copied(const Region &dest, const Point &delta);
+    virtual void add_hint(const Region &region, ContentHint hint);
     virtual void subtract(const Region& region);
 
     // Fill the supplied UpdateInfo structure with update information
@@ -80,21 +119,36 @@ namespace rfb {
     virtual void copyTo(UpdateTracker* to) const;
 
 
-    // Get the changed/copied regions
+    // Get the changed region and the list of copies.  get_copied() returns
+    // the union of the copies' destinations.
     const Region& get_changed() const {return changed;}
-    const Region& get_copied() const {return copied;}
-    const Point& get_delta() const {return copy_delta;}
+    const CopyList& get_copies() const {return copies;}
+    Region get_copied() const;
+    const Region& get_hinted(ContentHint h) const {return hints[h];}
 
     // Move the entire update region by an offset
-    void translate(const Point& p) {changed.translate(p); copied.translate(p);}
+    void translate(const Point& p);
 
-    virtual bool is_empty() const {return changed.is_empty() && copied.is_empty();}
+    virtual bool is_empty() const {return changed.is_empty() && copies.empty();}
 
-    virtual void clear() {changed.clear(); copied.clear();};
+    virtual void clear() {
+      changed.clear(); copies.clear();
+      for (int h = 0; h < numContentHints; h++) hints[h].clear();
+    };
   protected:
+    // removeFromCopies() removes the given region from the destinations of
+    // the copies, except where a later copy takes its source from there.
+    void removeFromCopies(const Region& region);
+
+    bool canCombine(CopyList::iterator op, const Region& newDest);
+
+    // removeFromHints() forgets what drew the given region, because something
+    // else has been drawn there since.
+    void removeFromHints(const Region& region);
+
     Region changed;
-    Region copied;
-    Point copy_delta;
+    Region hints[numContentHints];
+    CopyList copies;
     bool copy_enabled;
   };
 
@@ -16,12 +16,15 @@
  * USA.
  */
 
+#include <stdio.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/LogWriter.h>
 #include <rfb/secTypes.h>
 #include <rfb/ServerCore.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/ZRLEEncoder.h>
 #include <rfb/KeyRemapper.h>
+#include <rfb/util.h>
 #define XK_MISCELLANY
 #define XK_XKB_KEYS
 #include <rfb/keysymdef.h>
@@ -34,9 +37,13 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
                                    bool reverse)
   : SConnection(server_->securityFactory, reverse), sock(s), server(server_),
     updates(false), image_getter(server->useEconomicTranslate),
-    drawRenderedCursor(false), removeRenderedCursor(false),
-    pointerEventTime(0), accessRights(AccessDefault)
+    drawRenderedCursor(false), removeRenderedCursor(false), scaledPb(0),
+    adaptUpdates(0), adaptEncodeTime(0), adaptTimeWaited(0),
+    pointerEventTime(0), pointerPending(false), pointerButtonMask(0),
+    pointerEventsCoalesced(0), inputInBatch(false),
+    accessRights(AccessDefault)
 {
+  memset(inputLatency, 0, sizeof(inputLatency));
   setStreams(&sock->inStream(), &sock->outStream());
   peerEndpoint.buf = sock->getPeerEndpoint();
   VNCServerST::connectionsLog.write(1,"accepted: %s", peerEndpoint.buf);
@@ -57,6 +64,21 @@ VNCSConnectionST::~VNCSConnectionST()
                                     peerEndpoint.buf,
                                     (closeReason.buf) ? closeReason.buf : "");
 
+  static const char* bucketNames[inputLatencyBuckets] = {
+    "<1ms", "<2ms", "<5ms", "<10ms", "<20ms", "<50ms", "<100ms", ">=100ms"
+  };
+  char latency[256];
+  int len = 0;
+  for (int b = 0; b < inputLatencyBuckets; b++) {
+    if (inputLatency[b])
+      len += sprintf(latency + len, " %s %d",
+                     bucketNames[b], inputLatency[b]);
+  }
+  if (len)
+    vlog.info("input latency:%s", latency);
+  if (pointerEventsCoalesced)
+    vlog.info("pointer events coalesced %d", pointerEventsCoalesced);
+
   // Release any keys the client still had pressed
   std::set<rdr::U32>::iterator i;
   for (i=pressedKeys.begin(); i!=pressedKeys.end(); i++)
@@ -66,6 +88,8 @@ VNCSConnectionST::~VNCSConnectionST()
 
   // Remove this client from the server
   server->clients.remove(this);
+
+  delete scaledPb;
 }
 
 
@@ -106,10 +130,17 @@ void VNCSConnectionST::processMessages()
     setSocketTimeouts();
     bool clientsReadyBefore = server->clientsReadyForUpdate();
 
+    Timer::getTime(&batchStartTime);
     while (getInStream()->checkNoWait(1)) {
       processMsg();
     }
 
+    flushPointerEvent();
+    if (inputInBatch) {
+      server->desktop->inputFlush();
+      inputInBatch = false;
+    }
+
     if (!clientsReadyBefore && !requested.is_empty())
       server->desktop->framebufferUpdateRequest();
   } catch (rdr::EndOfStream&) {
@@ -132,8 +163,9 @@ void VNCSConnectionST::pixelBufferChange()
 {
   try {
     if (!authenticated()) return;
-    if (cp.width && cp.height && (server->pb->width() != cp.width ||
-                                  server->pb->height() != cp.height))
+    setupScaling();
+    if (cp.width && cp.height && (clientPb()->width() != cp.width ||
+                                  clientPb()->height() != cp.height))
     {
       // We need to clip the next update to the new size, but also add any
       // extra bits if it's bigger.  If we wanted to do this exactly, something
@@ -150,10 +182,10 @@ void VNCSConnectionST::pixelBufferChange()
       //  updates.add_changed(Rect(0, cp.height, cp.width,
       //                           server->pb->height()));
 
-      renderedCursorRect = renderedCursorRect.intersect(server->pb->getRect());
+      renderedCursorRect = renderedCursorRect.intersect(clientPb()->getRect());
 
-      cp.width = server->pb->width();
-      cp.height = server->pb->height();
+      cp.width = clientPb()->width();
+      cp.height = clientPb()->height();
       if (state() == RFBSTATE_NORMAL) {
         if (!writer()->writeSetDesktopSize()) {
           close("Client does not support desktop resize");
@@ -164,9 +196,11 @@ void VNCSConnectionST::pixelBufferChange()
     // Just update the whole screen at the moment because we're too lazy to
     // work out what's actually changed.
     updates.clear();
-    updates.add_changed(server->pb->getRect());
+    updates.add_changed(clientPb()->getRect());
+    reduced.clear();
+    refining.clear();
     vlog.debug("pixel buffer changed - re-initialising image getter");
-    image_getter.init(server->pb, cp.pf(), writer());
+    image_getter.init(clientPb(), cp.pf(), writer());
     if (writer()->needFakeUpdate())
       writeFramebufferUpdate();
   } catch(rdr::Exception &e) {
@@ -243,6 +277,38 @@ int VNCSConnectionST::checkIdleTimeout()
   return secsToMillis(timeLeft);
 }
 
+// add_changed(), add_hint() and add_copied() are given regions of the
+// server's framebuffer.  When scaling, the parts of the scaled framebuffer
+// which they affect become stale, and copies are sent as changes.
+
+void VNCSConnectionST::add_changed(const Region& region)
+{
+  if (scaledPb) {
+    Region scaled = toClient(region);
+    stale.assign_union(scaled);
+    updates.add_changed(scaled);
+    if (!refining.is_empty()) refining.assign_subtract(scaled);
+    return;
+  }
+  updates.add_changed(region);
+  if (!refining.is_empty()) refining.assign_subtract(region);
+}
+
+void VNCSConnectionST::add_hint(const Region& region, ContentHint hint)
+{
+  updates.add_hint(scaledPb ? toClient(region) : region, hint);
+}
+
+void VNCSConnectionST::add_copied(const Region& dest, const Point& delta)
+{
+  if (scaledPb) {
+    add_changed(dest);
+    return;
+  }
+  updates.add_copied(dest, delta);
+  if (!refining.is_empty()) refining.assign_subtract(dest);
+}
+
 // renderedCursorChange() is called whenever the server-side rendered cursor
 // changes shape or position.  It ensures that the next update will clean up
 // the old rendered cursor and if necessary draw the new rendered cursor.
@@ -255,9 +321,19 @@ void VNCSConnectionST::renderedCursorChange()
     drawRenderedCursor = true;
 }
 
+void VNCSConnectionST::cursorPosChange()
+{
+  if (state() != RFBSTATE_NORMAL || !cp.supportsLocalCursor) return;
+  if (server->cursorPos.equals(pointerEventPos) ||
+      (time(0) - pointerEventTime) <= 0)
+    return;
+  writer()->writeSetCursorPos(toClient(server->cursorPos));
+}
+
 // needRenderedCursor() returns true if this client needs the server-side
 // rendered cursor.  This may be because it does not support local cursor or
-// because the current cursor position has not been set by this client.
+// because the current cursor position has not been set by this client and
+// the client cannot be told where it is.
 // Unfortunately we can't know for sure when the current cursor position has
 // been set by this client.  We guess that this is the case when the current
 // cursor position is the same as the last pointer event from this client, or
@@ -267,9 +343,10 @@ void VNCSConnectionST::renderedCursorChange()
 
 bool VNCSConnectionST::needRenderedCursor()
 {
-  return (state() == RFBSTATE_NORMAL
+  return (state() == RFBSTATE_NORMAL && !scaledPb
           && (!cp.supportsLocalCursor
-              || (!server->cursorPos.equals(pointerEventPos) &&
+              || (!cp.supportsCursorPos &&
+                  !server->cursorPos.equals(pointerEventPos) &&
                   (time(0) - pointerEventTime) > 0)));
 }
 
@@ -373,7 +450,7 @@ void VNCSConnectionST::setPixelFormat(const PixelFormat& pf)
   char buffer[256];
   pf.print(buffer, 256);
   vlog.info("Client pixel format %s", buffer);
-  image_getter.init(server->pb, pf, writer());
+  image_getter.init(clientPb(), pf, writer());
   setCursor();
 }
 
@@ -383,15 +460,54 @@ void VNCSConnectionST::pointerEvent(const Point& pos, int buttonMask)
   if (!(accessRights & AccessPtrEvents)) return;
   if (!rfb::Server::acceptPointerEvents) return;
   if (!server->pointerClient || server->pointerClient == this) {
-    pointerEventPos = pos;
+    pointerEventPos = scaledPb ? toServer(pos) : pos;
     if (buttonMask)
       server->pointerClient = this;
     else
       server->pointerClient = 0;
+
+    // A move with the same buttons as before waits for the end of the batch,
+    // and replaces any move already waiting.  A change to the buttons is
+    // passed on at once, at its own position, so any waiting move is dropped.
+    if (buttonMask == pointerButtonMask) {
+      if (pointerPending)
+        pointerEventsCoalesced++;
+      pointerPending = true;
+      return;
+    }
+    pointerPending = false;
+    pointerButtonMask = buttonMask;
     server->desktop->pointerEvent(pointerEventPos, buttonMask);
+    inputInjected();
   }
 }
 
+// flushPointerEvent() passes on any pointer move which is waiting.
+
+void VNCSConnectionST::flushPointerEvent()
+{
+  if (!pointerPending) return;
+  pointerPending = false;
+  server->desktop->pointerEvent(pointerEventPos, pointerButtonMask);
+  inputInjected();
+}
+
+// inputInjected() is called each time an event has been passed on to the
+// desktop, to record how long it waited since the start of the batch.
+
+void VNCSConnectionST::inputInjected()
+{
+  static const int bucketLimits[inputLatencyBuckets-1] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000
+  };
+  int us = Timer::usSince(batchStartTime);
+  int b = 0;
+  while (b < inputLatencyBuckets-1 && us >= bucketLimits[b])
+    b++;
+  inputLatency[b]++;
+  inputInBatch = true;
+}
+
 
 class VNCSConnectionSTShiftPresser {
 public:
@@ -419,6 +535,9 @@ void VNCSConnectionST::keyEvent(rdr::U32 key, bool down) {
   if (server->keyRemapper)
     key = server->keyRemapper->remapKey(key);
 
+  // Keys must reach the desktop in order with the pointer.
+  flushPointerEvent();
+
   // Turn ISO_Left_Tab into shifted Tab.
   VNCSConnectionSTShiftPresser shiftPresser(server->desktop);
   if (key == XK_ISO_Left_Tab) {
@@ -433,7 +552,9 @@ void VNCSConnectionST::keyEvent(rdr::U32 key, bool down) {
   } else {
     if (!pressedKeys.erase(key)) return;
   }
+
   server->desktop->keyEvent(key, down);
+  inputInjected();
 }
 
 void VNCSConnectionST::clientCutText(const char* str, int len)
@@ -455,7 +576,7 @@ void VNCSConnectionST::framebufferUpdateRequest(const Rect& r,bool incremental)
   if (!incremental) {
     // Non-incremental update - treat as if area requested has changed
     updates.add_changed(reqRgn);
-    server->comparer->add_changed(reqRgn);
+    server->comparer->add_changed(scaledPb ? Region(toServer(r)) : reqRgn);
   }
 
   writeFramebufferUpdate();
@@ -480,6 +601,15 @@ void VNCSConnectionST::supportsLocalCursor()
   }
 }
 
+// setScalePercent() is called whenever the client asks for a different scale.
+// The new size is sent to it in the same way as when the server's framebuffer
+// changes size.
+
+void VNCSConnectionST::setScalePercent()
+{
+  pixelBufferChange();
+}
+
 void VNCSConnectionST::writeSetCursorCallback()
 {
   rdr::U8* transData = writer()->getImageBuf(server->cursor.area());
@@ -499,15 +629,19 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
   server->checkUpdate();
 
-  // If the previous position of the rendered cursor overlaps the source of the
+  // If the previous position of the rendered cursor overlaps the source of a
   // copy, then when the copy happens the corresponding rectangle in the
   // destination will be wrong, so add it to the changed region.
 
-  if (!updates.get_copied().is_empty() && !renderedCursorRect.is_empty()) {
-    Rect bogusCopiedCursor = (renderedCursorRect.translate(updates.get_delta())
-                              .intersect(server->pb->getRect()));
-    if (!updates.get_copied().intersect(bogusCopiedCursor).is_empty()) {
-      updates.add_changed(bogusCopiedCursor);
+  if (!renderedCursorRect.is_empty()) {
+    CopyList::const_iterator op;
+    for (op = updates.get_copies().begin();
+         op != updates.get_copies().end(); op++) {
+      Rect bogusCopiedCursor = (renderedCursorRect.translate(op->delta)
+                                .intersect(server->pb->getRect()));
+      if (!op->dest.intersect(bogusCopiedCursor).is_empty()) {
+        updates.add_changed(bogusCopiedCursor);
+      }
     }
   }
 
@@ -520,6 +654,15 @@ void VNCSConnectionST::writeFramebufferUpdate()
     removeRenderedCursor = false;
   }
 
+  // If there is nothing new to send, use the time to send again in full any
+  // areas which were sent in reduced colour.
+
+  if (updates.is_empty() && !reduced.is_empty()) {
+    Region refine = reduced.intersect(requested);
+    updates.add_changed(refine);
+    refining.assign_union(refine);
+  }
+
   // Return if there is nothing to send the client.
 
   if (updates.is_empty() && !writer()->needFakeUpdate() && !drawRenderedCursor)
@@ -551,19 +694,185 @@ void VNCSConnectionST::writeFramebufferUpdate()
     //  updates.subtract(renderedCursorRect);
   }
 
+  // Bring the scaled framebuffer up to date.  All of it is done rather than
+  // just the part being sent, since the rectangles sent may be merged over
+  // parts which were not requested.
+
+  if (scaledPb)
+    scaleStale();
+
   UpdateInfo update;
   updates.enable_copyrect(cp.useCopyRect);
   updates.getUpdateInfo(&update, requested);
   if (!update.is_empty() || writer()->needFakeUpdate() || drawRenderedCursor) {
-    int nRects = update.numRects() + (drawRenderedCursor ? 1 : 0);
+    int budget = updateBudget();
+    image_getter.setReducedColour(reduceColour(update, budget));
+
+    // Reduced colour pixels hold about a byte's worth of colour each, so
+    // the same time allows proportionally more of them.
+    if (image_getter.reducingColour())
+      budget = budget * (cp.pf().bpp / 8);
+    int nRects = writer()->planRects(update, budget, updateFocus());
+
+    // Merging rectangles may have extended the update over the rendered
+    // cursor, in which case it must be drawn again.
+    if (needRenderedCursor() && !renderedCursorRect.is_empty() &&
+        writer()->planOverlaps(renderedCursorRect))
+      drawRenderedCursor = true;
+    if (drawRenderedCursor)
+      nRects++;
+
     writer()->writeFramebufferUpdateStart(nRects);
-    Region updatedRegion;
-    writer()->writeRects(update, &image_getter, &updatedRegion);
+    Region updatedRegion, encodedRegion;
+    writer()->writeRects(update, &image_getter, &updatedRegion,
+                         &encodedRegion);
+    trackReduced(update, encodedRegion);
+    image_getter.setReducedColour(false);
     updates.subtract(updatedRegion);
     if (drawRenderedCursor)
       writeRenderedCursorRect();
     writer()->writeFramebufferUpdateEnd();
     requested.clear();
+
+    if (rfb::Server::adaptCompressLevel)
+      adaptCompressLevel();
+  }
+}
+
+
+// updateBudget() returns the most pixels to send in one update, or 0 for no
+// limit.  This stops a client with a large update, such as a non-incremental
+// request for the whole of a big screen, from holding up the other clients
+// and input for too long.  The rest of its update waits for its next request,
+// and other clients get their turn in between.  The time allowed is turned
+// into pixels using the rate at which this connection has been encoding and
+// writing so far.  Clients which may not send input get less time than
+// interactive ones.
+
+#define MIN_UPDATE_PIXELS (64*64*4)
+
+int VNCSConnectionST::updateBudget()
+{
+  int ms = rfb::Server::maxUpdateTime;
+  if (!(accessRights & (AccessPtrEvents | AccessKeyEvents)))
+    ms = rfb::Server::viewOnlyUpdateTime;
+  if (ms <= 0) return 0;
+
+  double rate = writer()->getEncodeRate();
+  if (rate <= 0) return 0;
+
+  double pixels = rate * ms / 1000;
+  if (pixels >= clientPb()->area()) return 0;
+  return __rfbmax((int)pixels, MIN_UPDATE_PIXELS);
+}
+
+
+// updateFocus() returns the point to plan the update around, or null.  While
+// the user is moving the pointer, the changes near it are the ones they are
+// waiting to see, so they are sent first and the rest follows after.
+
+const Point* VNCSConnectionST::updateFocus()
+{
+  if (!rfb::Server::pointerFirst || !(accessRights & AccessPtrEvents))
+    return 0;
+  if (time(0) - pointerEventTime > 1)
+    return 0;
+  focusPos = toClient(pointerEventPos);
+  return &focusPos;
+}
+
+
+// reduceColour() decides whether to send an update in reduced colour.  This
+// is done when the new changes in it are more than can be sent in the time
+// allowed for an update, such as when a window is maximised over a slow link,
+// so that the user sees something sooner.  Areas which are being refined are
+// not counted, since sending them in reduced colour again would never finish.
+
+bool VNCSConnectionST::reduceColour(const UpdateInfo& update, int budget)
+{
+  if (!rfb::Server::progressiveUpdates || !budget)
+    return false;
+
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  update.changed.subtract(refining).get_rects(&rects);
+  int area = 0;
+  for (i = rects.begin(); i != rects.end(); i++)
+    area += i->area();
+  return area > budget;
+}
+
+
+// trackReduced() keeps track of which parts of the client's framebuffer hold
+// reduced colour pixels after an update.  Copies move them around, and
+// encoded areas become reduced or exact depending on how they were sent.
+
+void VNCSConnectionST::trackReduced(const UpdateInfo& update,
+                                    const Region& encoded)
+{
+  if (!reduced.is_empty()) {
+    CopyList::const_iterator op;
+    for (op = update.copies.begin(); op != update.copies.end(); op++) {
+      Region moved = op->dest;
+      moved.translate(op->delta.negate());
+      moved.assign_intersect(reduced);
+      moved.translate(op->delta);
+      reduced.assign_subtract(op->dest);
+      reduced.assign_union(moved);
+    }
+  }
+
+  // Encoded rectangles are written after the copies, and may take in pixels
+  // outside the changed region where planRects() merged nearby rectangles,
+  // so all of them count, copy destinations included.
+  if (image_getter.reducingColour())
+    reduced.assign_union(encoded);
+  else
+    reduced.assign_subtract(encoded);
+  refining.assign_subtract(encoded);
+}
+
+
+// adaptCompressLevel() adjusts the zlib compression level of the connection,
+// unless the client has asked for a particular level.  Every ADAPT_UPDATES
+// updates it compares the time spent encoding with the time spent waiting for
+// the socket to drain.  Encoding includes writing, so the waiting time is
+// taken off it to give the CPU time.  Without a level of its own, the
+// connection starts from the level the encoder would use anyway.  If the
+// socket is the bottleneck then compressing harder pays off.  If it is hardly
+// ever waited for, then CPU time spent on compression is wasted and the level
+// is lowered.
+
+#define ADAPT_UPDATES 16
+
+void VNCSConnectionST::adaptCompressLevel()
+{
+  if (cp.compressLevel >= 0) return;
+  if (++adaptUpdates < ADAPT_UPDATES) return;
+
+  double encodeTime = writer()->getEncodeTime() - adaptEncodeTime;
+  unsigned int waited = sock->outStream().timeWaited() - adaptTimeWaited;
+  adaptEncodeTime = writer()->getEncodeTime();
+  adaptTimeWaited = sock->outStream().timeWaited();
+  adaptUpdates = 0;
+
+  // Waiting at the end of an update, when the socket is flushed, is not part
+  // of the encoding time, so there can be more waiting than encoding.
+  double waitTime = waited / 10000.0;
+  double cpuTime = __rfbmax(encodeTime - waitTime, 0.0);
+
+  int level = writer()->getCompressLevel();
+  if (level < 0) level = ZRLEEncoder::defaultCompressLevel();
+  int newLevel = level;
+  if (waitTime > cpuTime && level < 9)
+    newLevel = level + 1;
+  else if (waitTime * 4 < cpuTime && level > 1)
+    newLevel = level - 1;
+
+  if (newLevel != level) {
+    vlog.debug("compression level %d (encode %.1fms, waiting %.1fms)",
+               newLevel, cpuTime * 1000, waitTime * 1000);
+    writer()->setCompressLevel(newLevel);
   }
 }
 
@@ -579,7 +888,7 @@ void VNCSConnectionST::writeRenderedCursorRect()
   Rect actual;
   writer()->writeRect(renderedCursorRect, &image_getter, &actual);
 
-  image_getter.setPixelBuffer(server->pb);
+  image_getter.setPixelBuffer(clientPb());
   image_getter.setOffset(Point(0,0));
 
   drawRenderedCursor = false;
@@ -593,7 +902,7 @@ void VNCSConnectionST::setColourMapEntries(int firstColour, int nColours)
   image_getter.setColourMapEntries(firstColour, nColours, writer());
 
   if (cp.pf().trueColour) {
-    updates.add_changed(server->pb->getRect());
+    updates.add_changed(clientPb()->getRect());
   }
 }
 
@@ -619,3 +928,98 @@ void VNCSConnectionST::setSocketTimeouts()
   sock->inStream().setTimeout(timeoutms);
   sock->outStream().setTimeout(timeoutms);
 }
+
+
+// setupScaling() makes the scaled framebuffer to match the scale the client
+// asked for and the size of the server's framebuffer, or deletes it if the
+// client is not to be sent a scaled framebuffer.  Only true colour can be
+// scaled, and the client must support changes to the desktop size.
+
+void VNCSConnectionST::setupScaling()
+{
+  delete scaledPb;
+  scaledPb = 0;
+  stale.clear();
+
+  const PixelFormat& pf = server->pb->getPF();
+  int percent = cp.scalePercent;
+  if (percent <= 0 || percent >= 100 || !rfb::Server::allowScaling)
+    return;
+  if (!cp.supportsDesktopResize || !pf.trueColour) {
+    vlog.info("cannot scale for this client");
+    return;
+  }
+
+  int w = __rfbmax(server->pb->width() * percent / 100, 1);
+  int h = __rfbmax(server->pb->height() * percent / 100, 1);
+  scaledPb = new ManagedPixelBuffer(pf, w, h);
+
+  // The box filter averages each byte separately, so the channels must be
+  // whole bytes.
+  bool bytes = (pf.bpp == 32 && pf.redMax == 255 && pf.greenMax == 255 &&
+                pf.blueMax == 255 && pf.redShift % 8 == 0 &&
+                pf.greenShift % 8 == 0 && pf.blueShift % 8 == 0);
+  scaler.init(server->pb->width(), server->pb->height(), w, h, pf.bpp,
+              bytes ? ImageScaler::box : ImageScaler::nearest);
+  stale.reset(scaledPb->getRect());
+  vlog.info("scaling to %dx%d (%d%%)", w, h, percent);
+}
+
+// scaleStale() scales the stale parts of the scaled framebuffer again from
+// the server's framebuffer.
+
+void VNCSConnectionST::scaleStale()
+{
+  if (stale.is_empty()) return;
+
+  int srcStride, dstStride;
+  const rdr::U8* src = server->pb->getPixelsR(server->pb->getRect(),
+                                              &srcStride);
+  rdr::U8* dst = scaledPb->getPixelsRW(scaledPb->getRect(), &dstStride);
+
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  stale.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    scaler.scale(src, srcStride, dst, dstStride, *i);
+  stale.clear();
+}
+
+Region VNCSConnectionST::toClient(const Region& r) const
+{
+  Region scaled;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  r.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    scaled.assign_union(scaler.scaledRect(*i));
+  return scaled;
+}
+
+Point VNCSConnectionST::toClient(const Point& p) const
+{
+  if (!scaledPb) return p;
+  return Point(p.x * scaledPb->width() / server->pb->width(),
+               p.y * scaledPb->height() / server->pb->height());
+}
+
+Rect VNCSConnectionST::toServer(const Rect& r) const
+{
+  int sw = scaledPb->width(), sh = scaledPb->height();
+  int w = server->pb->width(), h = server->pb->height();
+  Rect sr(r.tl.x * w / sw, r.tl.y * h / sh,
+          (r.br.x * w + sw - 1) / sw, (r.br.y * h + sh - 1) / sh);
+  return sr.intersect(server->pb->getRect());
+}
+
+// toServer() maps a point to the middle of the server pixels which the
+// client pixel covers.
+
+Point VNCSConnectionST::toServer(const Point& p) const
+{
+  int sw = scaledPb->width(), sh = scaledPb->height();
+  int w = server->pb->width(), h = server->pb->height();
+  Point sp((p.x * 2 + 1) * w / (sw * 2), (p.y * 2 + 1) * h / (sh * 2));
+  return Point(__rfbmin(__rfbmax(sp.x, 0), w - 1),
+               __rfbmin(__rfbmax(sp.y, 0), h - 1));
+}
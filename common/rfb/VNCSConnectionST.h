@@ -31,6 +31,8 @@
 #include <rfb/SMsgWriter.h>
 #include <rfb/TransImageGetter.h>
 #include <rfb/VNCServerST.h>
+#include <rfb/Timer.h>
+#include <rfb/ImageScaler.h>
 
 namespace rfb {
   class VNCSConnectionST : public SConnection,
@@ -81,6 +83,12 @@ namespace rfb {
     // cursor.
     void renderedCursorChange();
 
+    // cursorPosChange() is called whenever the cursor position changes.  If
+    // the client supports it, and did not move the cursor itself, the new
+    // position is sent to it in the next update so that it can move its local
+    // cursor.
+    void cursorPosChange();
+
     // needRenderedCursor() returns true if this client needs the server-side
     // rendered cursor.  This may be because it does not support local cursor
     // or because the current cursor position has not been set by this client.
@@ -88,10 +96,9 @@ namespace rfb {
 
     network::Socket* getSock() { return sock; }
     bool readyForUpdate() { return !requested.is_empty(); }
-    void add_changed(const Region& region) { updates.add_changed(region); }
-    void add_copied(const Region& dest, const Point& delta) {
-      updates.add_copied(dest, delta);
-    }
+    void add_changed(const Region& region);
+    void add_hint(const Region& region, ContentHint hint);
+    void add_copied(const Region& dest, const Point& delta);
 
     const char* getPeerEndpoint() const {return peerEndpoint.buf;}
 
@@ -120,6 +127,7 @@ namespace rfb {
     virtual void framebufferUpdateRequest(const Rect& r, bool incremental);
     virtual void setInitialColourMap();
     virtual void supportsLocalCursor();
+    virtual void setScalePercent();
 
     // setAccessRights() allows a security package to limit the access rights
     // of a VNCSConnectioST to the server.  These access rights are applied
@@ -138,9 +146,24 @@ namespace rfb {
     void writeFramebufferUpdate();
 
     void writeRenderedCursorRect();
+    void flushPointerEvent();
+    void inputInjected();
+    void adaptCompressLevel();
+    int updateBudget();
+    const Point* updateFocus();
+    bool reduceColour(const UpdateInfo& update, int budget);
+    void trackReduced(const UpdateInfo& update, const Region& encoded);
     void setColourMapEntries(int firstColour, int nColours);
     void setCursor();
     void setSocketTimeouts();
+    void setupScaling();
+    void scaleStale();
+    PixelBuffer* clientPb() { return scaledPb ? (PixelBuffer*)scaledPb
+                                              : server->pb; }
+    Region toClient(const Region& r) const;
+    Point toClient(const Point& p) const;
+    Rect toServer(const Rect& r) const;
+    Point toServer(const Point& p) const;
 
     network::Socket* sock;
     CharArray peerEndpoint;
@@ -151,12 +174,45 @@ namespace rfb {
     bool drawRenderedCursor, removeRenderedCursor;
     Rect renderedCursorRect;
 
+    // reduced is the part of the client's framebuffer which was last sent in
+    // reduced colour, and refining the part of that which has been added to
+    // the updates to be sent again in full.
+    Region reduced;
+    Region refining;
+
+    // When the client has asked for the framebuffer to be scaled down,
+    // scaledPb holds the scaled copy which is sent to it, and stale the parts
+    // of it which have yet to be scaled again from the server's framebuffer.
+    // All the regions above are then in the client's coordinates, except for
+    // pointerEventPos.
+    ManagedPixelBuffer* scaledPb;
+    ImageScaler scaler;
+    Region stale;
+    Point focusPos;
+
+    int adaptUpdates;
+    double adaptEncodeTime;
+    unsigned int adaptTimeWaited;
+
     std::set<rdr::U32> pressedKeys;
 
     time_t lastEventTime;
     time_t pointerEventTime;
     Point pointerEventPos;
 
+    // Pointer motion is held back until the end of each batch of messages, so
+    // that several moves in one batch reach the desktop as one.
+    // pointerPending says whether there is a move waiting, to pointerEventPos
+    // with pointerButtonMask.  inputLatency[] is a histogram of the time from
+    // the start of a batch to each event being passed on.
+    bool pointerPending;
+    int pointerButtonMask;
+    int pointerEventsCoalesced;
+    bool inputInBatch;
+    timeval batchStartTime;
+    enum { inputLatencyBuckets = 8 };
+    int inputLatency[inputLatencyBuckets];
+
     AccessRights accessRights;
 
     CharArray closeReason;
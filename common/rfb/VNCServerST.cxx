@@ -235,6 +235,11 @@ void VNCServerST::add_copied(const Region& dest, const Point& delta)
   comparer->add_copied(dest, delta);
 }
 
+void VNCServerST::add_hint(const Region& region, ContentHint hint)
+{
+  comparer->add_hint(region, hint);
+}
+
 bool VNCServerST::clientsReadyForUpdate()
 {
   std::list<VNCSConnectionST*>::iterator ci;
@@ -252,6 +257,11 @@ void VNCServerST::tryUpdate()
     ci_next = ci; ci_next++;
     (*ci)->writeFramebufferUpdateOrClose();
   }
+
+  // Take turns at going first, so that one client with large updates can't
+  // always hold up the others.
+  if (clients.size() > 1)
+    clients.splice(clients.end(), clients, clients.begin());
 }
 
 void VNCServerST::setCursor(int width, int height, const Point& newHotspot,
@@ -280,8 +290,10 @@ void VNCServerST::setCursorPos(const Point& pos)
     cursorPos = pos;
     renderedCursorInvalid = true;
     std::list<VNCSConnectionST*>::iterator ci;
-    for (ci = clients.begin(); ci != clients.end(); ci++)
+    for (ci = clients.begin(); ci != clients.end(); ci++) {
       (*ci)->renderedCursorChange();
+      (*ci)->cursorPosChange();
+    }
   }
 }
 
@@ -399,6 +411,9 @@ void VNCServerST::checkUpdate()
   if (rfb::Server::compareFB)
     comparer->compare();
 
+  if (rfb::Server::findSolidAreas)
+    comparer->findSolidAreas();
+
   if (renderCursor) {
     pb->getImage(renderedCursor.data,
                  renderedCursor.getRect(renderedCursorTL));
@@ -411,8 +426,16 @@ void VNCServerST::checkUpdate()
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
   for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
     ci_next = ci; ci_next++;
-    (*ci)->add_copied(comparer->get_copied(), comparer->get_delta());
+    CopyList::const_iterator op;
+    for (op = comparer->get_copies().begin();
+         op != comparer->get_copies().end(); op++)
+      (*ci)->add_copied(op->dest, op->delta);
     (*ci)->add_changed(comparer->get_changed());
+    for (int h = 0; h < numContentHints; h++) {
+      const Region& hinted = comparer->get_hinted((ContentHint)h);
+      if (!hinted.is_empty())
+        (*ci)->add_hint(hinted, (ContentHint)h);
+    }
   }
 
   comparer->clear();
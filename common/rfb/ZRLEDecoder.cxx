@@ -24,6 +24,8 @@ using namespace rfb;
 #define EXTRA_ARGS CMsgHandler* handler
 #define FILL_RECT(r, p) handler->fillRect(r, p)
 #define IMAGE_RECT(r, p) handler->imageRect(r, p)
+#define GET_RAW_PIXELS(r, s) handler->getRawPixelsRW(r, s)
+#define RELEASE_RAW_PIXELS(r) handler->releaseRawPixels(r)
 #define BPP 8
 #include <rfb/zrleDecode.h>
 #undef BPP
@@ -69,6 +69,11 @@ ZRLEEncoder::~ZRLEEncoder()
     delete mos;
 }
 
+int ZRLEEncoder::defaultCompressLevel()
+{
+  return zlibLevel >= 0 ? (int)zlibLevel : 6;
+}
+
 bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
 {
   rdr::U8* imageBuf = writer->getImageBuf(64 * 64 * 4 + 4);
@@ -76,6 +81,10 @@ bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
   bool wroteAll = true;
   *actual = r;
 
+  int level = writer->getCompressLevel();
+  zos.setUnderlying(mos);
+  zos.setCompressionLevel(level >= 0 ? level : defaultCompressLevel());
+
   switch (writer->bpp()) {
   case 8:
     wroteAll = zrleEncode8(r, mos, &zos, imageBuf, maxLen, actual, ig);
@@ -42,6 +42,11 @@ namespace rfb {
     // ZRLEEncoders.  Should be called before any ZRLEEncoders are created.
     static void setSharedMos(rdr::MemOutStream* mos_) { sharedMos = mos_; }
 
+    // defaultCompressLevel() returns the zlib level used for connections
+    // which have not been given a level of their own.  This is the ZlibLevel
+    // parameter, or zlib's own default of 6 if that is not set.
+    static int defaultCompressLevel();
+
   private:
     ZRLEEncoder(SMsgWriter* writer);
     SMsgWriter* writer;
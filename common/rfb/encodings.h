@@ -32,6 +32,23 @@ namespace rfb {
   const unsigned int pseudoEncodingCursor = 0xffffff11;
   const unsigned int pseudoEncodingDesktopSize = 0xffffff21;
 
+  // pseudoEncodingCursorPos tells a client using a local cursor where the
+  // pointer has been moved to by someone else.  The position is given by the
+  // rectangle's x and y, and its width and height are zero.
+  const unsigned int pseudoEncodingCursorPos = 0xffffff18;
+
+  // The client asks for a zlib compression level from 0 to 9 by including
+  // pseudoEncodingCompressLevel0 plus the level in its encodings.
+  const unsigned int pseudoEncodingCompressLevel0 = 0xffffff00;
+  const unsigned int pseudoEncodingCompressLevel9 = 0xffffff09;
+
+  // The client asks the server to scale the framebuffer down to a percentage
+  // of its size by including pseudoEncodingScalePercent1 minus one plus the
+  // percentage in its encodings.  This range is private to this version of
+  // VNC, and the server says that it has scaled by sending a new desktop size.
+  const unsigned int pseudoEncodingScalePercent1 = 0xfffffe01;
+  const unsigned int pseudoEncodingScalePercent100 = 0xfffffe64;
+
   int encodingNum(const char* name);
   const char* encodingName(unsigned int num);
 }
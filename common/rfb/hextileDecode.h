@@ -23,9 +23,13 @@
 // EXTRA_ARGS         - optional extra arguments
 // FILL_RECT          - fill a rectangle with a single colour
 // IMAGE_RECT         - draw a rectangle of pixel data from a buffer
+// GET_RAW_PIXELS     - optional - get a pointer and stride to write the pixels
+//                      of a rectangle straight into, or null
+// RELEASE_RAW_PIXELS - finish writing pixels got with GET_RAW_PIXELS
 
 #include <rdr/InStream.h>
 #include <rfb/hextileConstants.h>
+#include <string.h>
 
 namespace rfb {
 
@@ -61,6 +65,16 @@ void HEXTILE_DECODE (const Rect& r, rdr::InStream* is, PIXEL_T* buf
       int tileType = is->readU8();
 
       if (tileType & hextileRaw) {
+#ifdef GET_RAW_PIXELS
+	int stride;
+	PIXEL_T* dst = (PIXEL_T*)GET_RAW_PIXELS(t, &stride);
+	if (dst) {
+	  for (int i = 0; i < t.height(); i++)
+	    is->readBytes(dst + i * stride, t.width() * (BPP/8));
+	  RELEASE_RAW_PIXELS(t);
+	  continue;
+	}
+#endif
 	is->readBytes(buf, t.area() * (BPP/8));
 	IMAGE_RECT(t, buf);
 	continue;
@@ -69,51 +83,90 @@ void HEXTILE_DECODE (const Rect& r, rdr::InStream* is, PIXEL_T* buf
       if (tileType & hextileBgSpecified)
 	bg = is->READ_PIXEL();
 
-#ifdef FAVOUR_FILL_RECT
-      FILL_RECT(t, bg);
-#else
-      int len = t.area();
-      PIXEL_T* ptr = (PIXEL_T*)buf;
-      while (len-- > 0) *ptr++ = bg;
-#endif
-
       if (tileType & hextileFgSpecified)
 	fg = is->READ_PIXEL();
 
-      if (tileType & hextileAnySubrects) {
-        int nSubrects = is->readU8();
-
-        for (int i = 0; i < nSubrects; i++) {
-
-          if (tileType & hextileSubrectsColoured)
-            fg = is->READ_PIXEL();
+      // A tile with no subrects is just its background
+      if (!(tileType & hextileAnySubrects)) {
+        FILL_RECT(t, bg);
+        continue;
+      }
 
-          int xy = is->readU8();
-          int wh = is->readU8();
+      // The subrects are read in one go and then taken from memory.
+      // Pixels are sent in our byte order, like readOpaque.
+      int nSubrects = is->readU8();
+      bool coloured = tileType & hextileSubrectsColoured;
+      int subrectSize = 2 + (coloured ? BPP/8 : 0);
+      rdr::U8 subrects[255 * (2 + BPP/8)];
+      is->readBytes(subrects, nSubrects * subrectSize);
+      const rdr::U8* sp = subrects;
 
 #ifdef FAVOUR_FILL_RECT
-          Rect s;
-          s.tl.x = t.tl.x + ((xy >> 4) & 15);
-          s.tl.y = t.tl.y + (xy & 15);
-          s.br.x = s.tl.x + ((wh >> 4) & 15) + 1;
-          s.br.y = s.tl.y + (wh & 15) + 1;
-          FILL_RECT(s, fg);
+      FILL_RECT(t, bg);
+      for (int i = 0; i < nSubrects; i++) {
+        if (coloured) {
+          memcpy(&fg, sp, BPP/8);
+          sp += BPP/8;
+        }
+        int xy = *sp++;
+        int wh = *sp++;
+        Rect s;
+        s.tl.x = t.tl.x + ((xy >> 4) & 15);
+        s.tl.y = t.tl.y + (xy & 15);
+        s.br.x = s.tl.x + ((wh >> 4) & 15) + 1;
+        s.br.y = s.tl.y + (wh & 15) + 1;
+        FILL_RECT(s, fg);
+      }
 #else
-          int x = ((xy >> 4) & 15);
-          int y = (xy & 15);
-          int w = ((wh >> 4) & 15) + 1;
-          int h = (wh & 15) + 1;
-          PIXEL_T* ptr = (PIXEL_T*)buf + y * t.width() + x;
-          int rowAdd = t.width() - w;
-          while (h-- > 0) {
-            int len = w;
-            while (len-- > 0) *ptr++ = fg;
-            ptr += rowAdd;
-          }
+      // The tile is drawn straight into the framebuffer if we may, otherwise
+      // into buf and then copied.
+      PIXEL_T* dst = buf;
+      int stride = t.width();
+#ifdef GET_RAW_PIXELS
+      PIXEL_T* raw = (PIXEL_T*)GET_RAW_PIXELS(t, &stride);
+      if (raw)
+        dst = raw;
+      else
+        stride = t.width();
 #endif
+
+      for (int y = 0; y < t.height(); y++) {
+        PIXEL_T* ptr = dst + y * stride;
+        for (int x = 0; x < t.width(); x++)
+          ptr[x] = bg;
+      }
+
+      for (int i = 0; i < nSubrects; i++) {
+
+        if (coloured) {
+          memcpy(&fg, sp, BPP/8);
+          sp += BPP/8;
+        }
+
+        int xy = *sp++;
+        int wh = *sp++;
+        int w = ((wh >> 4) & 15) + 1;
+        int h = (wh & 15) + 1;
+        PIXEL_T* ptr = dst + (xy & 15) * stride + ((xy >> 4) & 15);
+
+        // Text is mostly single pixels and one pixel wide strokes, which are
+        // quicker without the inner loop.
+        if (w == 1) {
+          for (; h > 0; h--, ptr += stride)
+            *ptr = fg;
+        } else {
+          for (; h > 0; h--, ptr += stride)
+            for (int x = 0; x < w; x++)
+              ptr[x] = fg;
         }
       }
-#ifndef FAVOUR_FILL_RECT
+
+#ifdef GET_RAW_PIXELS
+      if (raw) {
+        RELEASE_RAW_PIXELS(t);
+        continue;
+      }
+#endif
       IMAGE_RECT(t, buf);
 #endif
     }
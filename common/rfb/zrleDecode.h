@@ -24,10 +24,14 @@
 // EXTRA_ARGS         - optional extra arguments
 // FILL_RECT          - fill a rectangle with a single colour
 // IMAGE_RECT         - draw a rectangle of pixel data from a buffer
+// GET_RAW_PIXELS     - optional - get a pointer and stride to write the pixels
+//                      of a rectangle straight into, or null
+// RELEASE_RAW_PIXELS - finish writing pixels got with GET_RAW_PIXELS
 
 #include <rdr/InStream.h>
 #include <rdr/ZlibInStream.h>
 #include <assert.h>
+#include <string.h>
 
 namespace rfb {
 
@@ -38,10 +42,69 @@ namespace rfb {
 #define CONCAT2E(a,b) CONCAT2(a,b)
 #endif
 
+#ifndef ZRLE_DECODE_ONCE
+#define ZRLE_DECODE_ONCE
+
+// Where the three bytes of a compressed pixel go within the full pixel
+#define CPIXEL_OFFSET_24A 0
+#define CPIXEL_OFFSET_24B 1
+
+// zrleFillPixels() sets len pixels to pix.  Long runs are filled by copying
+// the pixels already set in doubling chunks, so that memcpy() can use its
+// widest stores.
+
+template<class T>
+inline void zrleFillPixels(T* ptr, T pix, int len)
+{
+  if (len < 16) {
+    while (len-- > 0) *ptr++ = pix;
+    return;
+  }
+  for (int i = 0; i < 8; i++) ptr[i] = pix;
+  for (int done = 8; done < len; done *= 2)
+    memcpy(ptr + done, ptr, __rfbmin(done, len - done) * sizeof(T));
+}
+
+// zrleUnpackRow() expands a row of w palette indices packed BPPP bits to the
+// byte.  Each nibble of a byte is looked up in lut, which holds the 4/BPPP
+// pixels for every possible nibble, so that whole bytes become straight
+// copies.  Any pixels in a final part byte are looked up one by one.
+
+template<class T, int BPPP>
+inline void zrleUnpackRow(T* ptr, const rdr::U8* packed, int w,
+                          const T* lut, const T* palette)
+{
+  const int perNibble = 4 / BPPP;
+  int x = 0;
+  for (; x + 2 * perNibble <= w; x += 2 * perNibble) {
+    rdr::U8 byte = *packed++;
+    memcpy(ptr + x, lut + (byte >> 4) * perNibble, perNibble * sizeof(T));
+    memcpy(ptr + x + perNibble, lut + (byte & 15) * perNibble,
+           perNibble * sizeof(T));
+  }
+  for (int shift = 8; x < w; x++) {
+    shift -= BPPP;
+    ptr[x] = palette[(*packed >> shift) & ((1 << BPPP) - 1)];
+  }
+}
+
+template<class T, int BPPP>
+inline void zrleMakeLut(T* lut, const T* palette)
+{
+  const int perNibble = 4 / BPPP;
+  for (int n = 0; n < 16; n++)
+    for (int i = 0; i < perNibble; i++)
+      lut[n * perNibble + i] =
+        palette[(n >> (4 - BPPP * (i + 1))) & ((1 << BPPP) - 1)];
+}
+
+#endif
+
 #ifdef CPIXEL
 #define PIXEL_T rdr::CONCAT2E(U,BPP)
 #define READ_PIXEL CONCAT2E(readOpaque,CPIXEL)
 #define ZRLE_DECODE CONCAT2E(zrleDecode,CPIXEL)
+#define CPIXEL_OFFSET CONCAT2E(CPIXEL_OFFSET_,CPIXEL)
 #else
 #define PIXEL_T rdr::CONCAT2E(U,BPP)
 #define READ_PIXEL CONCAT2E(readOpaque,BPP)
@@ -88,10 +151,32 @@ void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
           // raw
 
 #ifdef CPIXEL
-          for (PIXEL_T* ptr = buf; ptr < buf+t.area(); ptr++) {
-            *ptr = zis->READ_PIXEL();
+          // The 3-byte pixels are read in one go into the end of the
+          // buffer, then spread out front to back, so that each is
+          // read before it is written over.
+          int area = t.area();
+          rdr::U8* packed = (rdr::U8*)buf + area;
+          zis->readBytes(packed, area * 3);
+          rdr::U8* out = (rdr::U8*)buf;
+          for (int i = 0; i < area; i++) {
+            const rdr::U8* in = packed + i * 3;
+            out[CPIXEL_OFFSET] = in[0];
+            out[CPIXEL_OFFSET + 1] = in[1];
+            out[CPIXEL_OFFSET + 2] = in[2];
+            out[CPIXEL_OFFSET ? 0 : 3] = 0;
+            out += 4;
           }
 #else
+#ifdef GET_RAW_PIXELS
+          int stride;
+          PIXEL_T* dst = (PIXEL_T*)GET_RAW_PIXELS(t, &stride);
+          if (dst) {
+            for (int i = 0; i < t.height(); i++)
+              zis->readBytes(dst + i * stride, t.width() * (BPP / 8));
+            RELEASE_RAW_PIXELS(t);
+            continue;
+          }
+#endif
           zis->readBytes(buf, t.area() * (BPP / 8));
 #endif
 
@@ -101,22 +186,35 @@ void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
           int bppp = ((palSize > 16) ? 8 :
                       ((palSize > 4) ? 4 : ((palSize > 2) ? 2 : 1)));
 
+          // Each row is read in one go and expanded through a table
+          int rowBytes = (t.width() * bppp + 7) / 8;
+          rdr::U8 packed[64];
+          PIXEL_T lut[64];
+          switch (bppp) {
+          case 1: zrleMakeLut<PIXEL_T,1>(lut, palette); break;
+          case 2: zrleMakeLut<PIXEL_T,2>(lut, palette); break;
+          case 4: zrleMakeLut<PIXEL_T,4>(lut, palette); break;
+          }
+
           PIXEL_T* ptr = buf;
 
           for (int i = 0; i < t.height(); i++) {
-            PIXEL_T* eol = ptr + t.width();
-            rdr::U8 byte = 0;
-            rdr::U8 nbits = 0;
-
-            while (ptr < eol) {
-              if (nbits == 0) {
-                byte = zis->readU8();
-                nbits = 8;
-              }
-              nbits -= bppp;
-              rdr::U8 index = (byte >> nbits) & ((1 << bppp) - 1) & 127;
-              *ptr++ = palette[index];
+            zis->readBytes(packed, rowBytes);
+            switch (bppp) {
+            case 1:
+              zrleUnpackRow<PIXEL_T,1>(ptr, packed, t.width(), lut, palette);
+              break;
+            case 2:
+              zrleUnpackRow<PIXEL_T,2>(ptr, packed, t.width(), lut, palette);
+              break;
+            case 4:
+              zrleUnpackRow<PIXEL_T,4>(ptr, packed, t.width(), lut, palette);
+              break;
+            default:
+              for (int x = 0; x < t.width(); x++)
+                ptr[x] = palette[packed[x] & 127];
             }
+            ptr += t.width();
           }
         }
 
@@ -173,7 +271,8 @@ void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
               FILL_RECT(Rect(t.tl.x+runX, t.tl.y+runY, len, 1), pix);
             }
 #else
-            while (len-- > 0) *ptr++ = pix;
+            zrleFillPixels(ptr, pix, len);
+            ptr += len;
 #endif
 
           }
@@ -228,7 +327,8 @@ void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
               FILL_RECT(Rect(t.tl.x+runX, t.tl.y+runY, len, 1), pix);
             }
 #else
-            while (len-- > 0) *ptr++ = pix;
+            zrleFillPixels(ptr, pix, len);
+            ptr += len;
 #endif
           }
         }
@@ -246,6 +346,7 @@ void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
 }
 
 #undef ZRLE_DECODE
+#undef CPIXEL_OFFSET
 #undef READ_PIXEL
 #undef PIXEL_T
 }
@@ -0,0 +1,423 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// decodebench - checks and times the ZRLE and Hextile decoders.
+//
+// Random images at 8, 16 and 32 bits per pixel, with palettes and runs of
+// every size so that each kind of tile turns up, are encoded with the
+// server's encoders and must decode to the same pixels.  This is done both
+// writing straight into the framebuffer and going through fillRect() and
+// imageRect().  The decoders are then timed on 1920x1080 frames of text, flat
+// windows and photo-like content.  For ZRLE the time to inflate the zlib
+// stream alone is also given, since no decoder can go faster than that.  The
+// exit status is non-zero if any image came out different.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <rdr/MemInStream.h>
+#include <rdr/MemOutStream.h>
+#include <rdr/ZlibInStream.h>
+#include <rdr/ZlibOutStream.h>
+#include <rdr/Exception.h>
+#include <rfb/PixelBuffer.h>
+
+using namespace rfb;
+using namespace rdr;
+
+#define EXTRA_ARGS ImageGetter* ig
+#define GET_IMAGE_INTO_BUF(r,buf) ig->getImage(buf, r);
+#define BPP 8
+#include <rfb/zrleEncode.h>
+#include <rfb/hextileEncode.h>
+#undef BPP
+#define BPP 16
+#include <rfb/zrleEncode.h>
+#include <rfb/hextileEncode.h>
+#undef BPP
+#define BPP 32
+#include <rfb/zrleEncode.h>
+#include <rfb/hextileEncode.h>
+#define CPIXEL 24A
+#include <rfb/zrleEncode.h>
+#undef CPIXEL
+#define CPIXEL 24B
+#include <rfb/zrleEncode.h>
+#undef CPIXEL
+#undef BPP
+#undef EXTRA_ARGS
+#undef GET_IMAGE_INTO_BUF
+
+// The decoders which write straight into the pixels, as the viewer does
+// where it can.
+
+#define EXTRA_ARGS FullFramePixelBuffer* pb
+#define FILL_RECT(r, p) pb->fillRect(r, p)
+#define IMAGE_RECT(r, p) pb->imageRect(r, p)
+#define GET_RAW_PIXELS(r, s) pb->getPixelsRW(r, s)
+#define RELEASE_RAW_PIXELS(r)
+#define BPP 8
+#include <rfb/zrleDecode.h>
+#include <rfb/hextileDecode.h>
+#undef BPP
+#define BPP 16
+#include <rfb/zrleDecode.h>
+#include <rfb/hextileDecode.h>
+#undef BPP
+#define BPP 32
+#include <rfb/zrleDecode.h>
+#include <rfb/hextileDecode.h>
+#define CPIXEL 24A
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#define CPIXEL 24B
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#undef BPP
+#undef EXTRA_ARGS
+#undef FILL_RECT
+#undef IMAGE_RECT
+#undef GET_RAW_PIXELS
+#undef RELEASE_RAW_PIXELS
+
+// And the ones which only use fillRect() and imageRect().
+
+struct CopyOnly {
+  CopyOnly(FullFramePixelBuffer* pb_) : pb(pb_) {}
+  FullFramePixelBuffer* pb;
+};
+
+#define EXTRA_ARGS CopyOnly copy
+#define FILL_RECT(r, p) copy.pb->fillRect(r, p)
+#define IMAGE_RECT(r, p) copy.pb->imageRect(r, p)
+#define BPP 8
+#include <rfb/zrleDecode.h>
+#include <rfb/hextileDecode.h>
+#undef BPP
+#define BPP 16
+#include <rfb/zrleDecode.h>
+#include <rfb/hextileDecode.h>
+#undef BPP
+#define BPP 32
+#include <rfb/zrleDecode.h>
+#include <rfb/hextileDecode.h>
+#define CPIXEL 24A
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#define CPIXEL 24B
+#include <rfb/zrleDecode.h>
+#undef CPIXEL
+#undef BPP
+#undef EXTRA_ARGS
+#undef FILL_RECT
+#undef IMAGE_RECT
+
+// A Format is a pixel format together with the ZRLE functions for it.  For
+// the compressed 24-bit pixels, unused is the byte of each pixel which is not
+// sent, and so is left zero in the images.
+
+typedef bool (*ZrleEncodeFn)(const Rect& r, OutStream* os, ZlibOutStream* zos,
+                             void* buf, int maxLen, Rect* actual,
+                             ImageGetter* ig);
+typedef void (*HextileEncodeFn)(const Rect& r, OutStream* os,
+                                ImageGetter* ig);
+
+struct Format {
+  const char* name;
+  PixelFormat pf;
+  int unused;
+  ZrleEncodeFn zrleEncode;
+  HextileEncodeFn hextileEncode;
+};
+
+static const PixelFormat pf8(8, 8, false, true, 7, 7, 3, 0, 3, 6);
+static const PixelFormat pf16(16, 16, false, true, 31, 63, 31, 11, 5, 0);
+static const PixelFormat pf32(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+
+static const Format formats[] = {
+  { "8",   pf8,  -1, zrleEncode8,   hextileEncode8 },
+  { "16",  pf16, -1, zrleEncode16,  hextileEncode16 },
+  { "32",  pf32, -1, zrleEncode32,  hextileEncode32 },
+  { "24A", pf32, 3,  zrleEncode24A, 0 },
+  { "24B", pf32, 0,  zrleEncode24B, 0 },
+};
+
+static const int nFormats = sizeof(formats) / sizeof(formats[0]);
+
+static U8 buf[64 * 64 * 4 + 4];
+
+// zrleDecode() and hextileDecode() pick the decoder for the format.
+
+static void zrleDecode(int f, const Rect& r, InStream* is, ZlibInStream* zis,
+                       FullFramePixelBuffer* pb, bool direct)
+{
+  if (direct) {
+    switch (f) {
+    case 0: zrleDecode8(r, is, zis, (U8*)buf, pb);     break;
+    case 1: zrleDecode16(r, is, zis, (U16*)buf, pb);   break;
+    case 2: zrleDecode32(r, is, zis, (U32*)buf, pb);   break;
+    case 3: zrleDecode24A(r, is, zis, (U32*)buf, pb);  break;
+    case 4: zrleDecode24B(r, is, zis, (U32*)buf, pb);  break;
+    }
+  } else {
+    CopyOnly copy(pb);
+    switch (f) {
+    case 0: zrleDecode8(r, is, zis, (U8*)buf, copy);    break;
+    case 1: zrleDecode16(r, is, zis, (U16*)buf, copy);  break;
+    case 2: zrleDecode32(r, is, zis, (U32*)buf, copy);  break;
+    case 3: zrleDecode24A(r, is, zis, (U32*)buf, copy); break;
+    case 4: zrleDecode24B(r, is, zis, (U32*)buf, copy); break;
+    }
+  }
+}
+
+static void hextileDecode(int f, const Rect& r, InStream* is,
+                          FullFramePixelBuffer* pb, bool direct)
+{
+  if (direct) {
+    switch (f) {
+    case 0: hextileDecode8(r, is, (U8*)buf, pb);     break;
+    case 1: hextileDecode16(r, is, (U16*)buf, pb);   break;
+    case 2: hextileDecode32(r, is, (U32*)buf, pb);   break;
+    }
+  } else {
+    CopyOnly copy(pb);
+    switch (f) {
+    case 0: hextileDecode8(r, is, (U8*)buf, copy);   break;
+    case 1: hextileDecode16(r, is, (U16*)buf, copy); break;
+    case 2: hextileDecode32(r, is, (U32*)buf, copy); break;
+    }
+  }
+}
+
+// encodeZrle() encodes the whole of pb, with the length in front as the
+// ZRLE encoder writes it.
+
+static void encodeZrle(const Format& f, ManagedPixelBuffer* pb,
+                       MemOutStream* out)
+{
+  MemOutStream mos;
+  ZlibOutStream zos(0, 0, 6);
+  f.zrleEncode(pb->getRect(), &mos, &zos, buf, 1 << 30, 0, pb);
+  out->writeU32(mos.length());
+  out->writeBytes(mos.data(), mos.length());
+}
+
+static bool samePixels(ManagedPixelBuffer* a, ManagedPixelBuffer* b)
+{
+  return memcmp(a->data, b->data, a->dataLen()) == 0;
+}
+
+// -=- Checks
+
+static void makeRandomImage(const Format& f, ManagedPixelBuffer* pb)
+{
+  int bytesPerPixel = f.pf.bpp / 8;
+  int nColours = 1 + rand() % (rand() % 3 ? 20 : 300);
+  int runLength = 1 + rand() % 20;
+  U8 palette[300][4];
+  for (int i = 0; i < nColours; i++) {
+    for (int j = 0; j < 4; j++)
+      palette[i][j] = rand();
+    if (f.unused >= 0)
+      palette[i][f.unused] = 0;
+  }
+  int colour = 0;
+  for (int i = 0; i < pb->width() * pb->height(); i++) {
+    if (rand() % runLength == 0)
+      colour = rand() % nColours;
+    memcpy(pb->data + i * bytesPerPixel, palette[colour], bytesPerPixel);
+  }
+}
+
+static int checkFormat(int fi)
+{
+  const Format& f = formats[fi];
+  int failed = 0;
+
+  for (int i = 0; i < 300; i++) {
+    int w = 1 + rand() % 200;
+    int h = 1 + rand() % 150;
+    ManagedPixelBuffer src(f.pf, w, h);
+    makeRandomImage(f, &src);
+
+    MemOutStream zrle;
+    encodeZrle(f, &src, &zrle);
+    MemOutStream hextile;
+    if (f.hextileEncode)
+      f.hextileEncode(src.getRect(), &hextile, &src);
+
+    for (int direct = 0; direct < 2; direct++) {
+      ManagedPixelBuffer dst(f.pf, w, h);
+      MemInStream zis_in(zrle.data(), zrle.length());
+      ZlibInStream zis;
+      zrleDecode(fi, src.getRect(), &zis_in, &zis, &dst, direct);
+      if (!samePixels(&src, &dst)) {
+        fprintf(stderr, "zrle %s %dx%d image %d differs\n", f.name, w, h, i);
+        failed++;
+      }
+
+      if (!f.hextileEncode) continue;
+      ManagedPixelBuffer dst2(f.pf, w, h);
+      MemInStream his(hextile.data(), hextile.length());
+      hextileDecode(fi, src.getRect(), &his, &dst2, direct);
+      if (!samePixels(&src, &dst2)) {
+        fprintf(stderr, "hextile %s %dx%d image %d differs\n", f.name, w, h,
+                i);
+        failed++;
+      }
+    }
+  }
+
+  if (!failed)
+    printf("%-3s bpp: zrle%s decode the same as encoded\n", f.name,
+           f.hextileEncode ? " and hextile" : "");
+  return failed;
+}
+
+// -=- Timings
+
+static const int width = 1920;
+static const int height = 1080;
+static const char* contents[] = { "text", "flat", "photo" };
+
+// Text is a few colours in small shapes, which ZRLE sends as packed palette
+// tiles and Hextile as many small subrects.  Flat windows are mostly solid
+// tiles.  Photo-like content has too many colours for a palette.
+
+static void makeFrame(int content, ManagedPixelBuffer* pb)
+{
+  U32* p = (U32*)pb->data;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      U32 v;
+      switch (content) {
+      case 0:
+        if ((x / 7 + y / 11) % 5 == 0 && (x * y) % 3)
+          v = 0x202020;
+        else
+          v = (x * 13 + y * 7) % 17 < 3 ? 0x3050a0 : 0xf0f0f0;
+        break;
+      case 1:
+        v = ((x / 300 + y / 200) % 3) * 0x405060;
+        if (x % 300 < 2 || y % 200 < 2)
+          v += 0x111111;
+        break;
+      default:
+        v = (((x * 3 + y) & 255) | (((y * 2 + (x >> 2)) & 255) << 8) |
+             (((x * y) & 63) << 16));
+        break;
+      }
+      *p++ = v;
+    }
+  }
+}
+
+// Each timing is the best of a number of frames, which keeps out most of the
+// noise from other processes.
+
+static const int reps = 20;
+
+static double timeZrle(int fi, MemOutStream& data,
+                       ManagedPixelBuffer* dst)
+{
+  double best = 1e9;
+  for (int rep = 0; rep < reps; rep++) {
+    clock_t start = clock();
+    MemInStream is(data.data(), data.length());
+    ZlibInStream zis;
+    zrleDecode(fi, dst->getRect(), &is, &zis, dst, true);
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+static double timeInflate(MemOutStream& data)
+{
+  static U8 out[64 * 1024];
+  double best = 1e9;
+  for (int rep = 0; rep < reps; rep++) {
+    clock_t start = clock();
+    MemInStream is(data.data(), data.length());
+    ZlibInStream zis;
+    zis.setUnderlying(&is, is.readU32());
+    try {
+      for (;;) {
+        int n = zis.check(1, sizeof(out));
+        zis.readBytes(out, n);
+      }
+    } catch (rdr::EndOfStream&) {
+    }
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+static double timeHextile(MemOutStream& data, ManagedPixelBuffer* dst)
+{
+  double best = 1e9;
+  for (int rep = 0; rep < reps; rep++) {
+    clock_t start = clock();
+    MemInStream is(data.data(), data.length());
+    hextileDecode(2, dst->getRect(), &is, dst, true);
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+int main()
+{
+  srand(1);
+  int failed = 0;
+  for (int fi = 0; fi < nFormats; fi++)
+    failed += checkFormat(fi);
+
+  printf("\nms per %dx%d frame at 32bpp\n", width, height);
+  printf("         zrle  (inflate)  zrle 24A  hextile\n");
+  for (int content = 0; content < 3; content++) {
+    ManagedPixelBuffer src(pf32, width, height);
+    ManagedPixelBuffer dst(pf32, width, height);
+    makeFrame(content, &src);
+
+    MemOutStream zrle, zrle24, hextile;
+    encodeZrle(formats[2], &src, &zrle);
+    encodeZrle(formats[3], &src, &zrle24);
+    hextileEncode32(src.getRect(), &hextile, &src);
+
+    double z = timeZrle(2, zrle, &dst);
+    bool same = samePixels(&src, &dst);
+    double inflate = timeInflate(zrle);
+    double z24 = timeZrle(3, zrle24, &dst);
+    same = same && samePixels(&src, &dst);
+    double h = timeHextile(hextile, &dst);
+    same = same && samePixels(&src, &dst);
+
+    printf("%-6s %6.2f   (%6.2f)    %6.2f   %6.2f%s\n", contents[content],
+           z * 1000, inflate * 1000, z24 * 1000, h * 1000,
+           same ? "" : "  DIFFERENT");
+    if (!same)
+      failed++;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// pixelbench - checks and times the pixel kernels behind fillRect() and
+// maskRect().
+//
+// Every kernel the processor supports is run on random rows, of random
+// lengths and mask offsets, and must give the same pixels as the plain C one,
+// leaving the bytes either side alone.  Each is then timed over a 1920x1080
+// frame.  The exit status is non-zero if any kernel gave different pixels.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <rfb/PixelBuffer.h>
+
+using namespace rfb;
+using namespace rdr;
+
+static const int width = 1920;
+static const int height = 1080;
+static const int guard = 32;
+
+static void randomBytes(U8* buf, int len)
+{
+  for (int i = 0; i < len; i++)
+    buf[i] = rand();
+}
+
+// The masks are random bytes, or for the timings either random or mostly
+// runs of set and clear bits like a cursor or text.
+
+static void makeMask(U8* mask, int len, bool runs)
+{
+  randomBytes(mask, len);
+  if (!runs) return;
+  for (int i = 0; i < len; i++) {
+    switch (mask[i] % 4) {
+    case 0: mask[i] = 0;    break;
+    case 1: mask[i] = 0xff; break;
+    }
+  }
+}
+
+static const PixelKernel* plainKernel(int bytesPerPixel)
+{
+  for (const PixelKernel* k = pixelKernels(); k->name; k++)
+    if (k->bytesPerPixel == bytesPerPixel && strcmp(k->name, "C") == 0)
+      return k;
+  return 0;
+}
+
+static bool checkKernel(const PixelKernel* k, const PixelKernel* c)
+{
+  int bpp = k->bytesPerPixel;
+  int rowBytes = 300 * bpp;
+  U8 src[300 * 4];
+  U8 mask[300 / 8 + 2];
+  U8 want[300 * 4 + 2 * guard];
+  U8 got[300 * 4 + 2 * guard];
+
+  // The rows start at any whole pixel, so as to try unaligned vectors.
+  for (int i = 0; i < 20000; i++) {
+    int n = rand() % 290;
+    int offset = rand() % 16 & ~(bpp - 1);
+    randomBytes(want, sizeof(want));
+    memcpy(got, want, sizeof(want));
+
+    if (i % 2 == 0) {
+      if (!k->fillRow) continue;
+      Pixel pix = rand();
+      c->fillRow(want + guard + offset, pix, n);
+      k->fillRow(got + guard + offset, pix, n);
+    } else {
+      if (!k->maskRow) continue;
+      int x = rand() % 8;
+      randomBytes(src, rowBytes);
+      makeMask(mask, sizeof(mask), i % 4 == 1);
+      c->maskRow(want + guard + offset, src + offset, mask, x, n);
+      k->maskRow(got + guard + offset, src + offset, mask, x, n);
+    }
+
+    if (memcmp(want, got, sizeof(want)) != 0) {
+      fprintf(stderr, "%s %s row of %d %d-byte pixels differs from C\n",
+              k->name, i % 2 ? "mask" : "fill", n, bpp);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Each timing is the best of a number of frames, which keeps out most of the
+// noise from other processes.
+
+static double timeFill(const PixelKernel* k, U8* frame)
+{
+  double best = 1e9;
+  for (int rep = 0; rep < 50; rep++) {
+    clock_t start = clock();
+    for (int y = 0; y < height; y++)
+      k->fillRow(frame + y * width * k->bytesPerPixel, 0x12345678, width);
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+static double timeMask(const PixelKernel* k, U8* frame, const U8* src,
+                       const U8* mask)
+{
+  double best = 1e9;
+  for (int rep = 0; rep < 50; rep++) {
+    clock_t start = clock();
+    for (int y = 0; y < height; y++)
+      k->maskRow(frame + y * width * k->bytesPerPixel,
+                 src + y * width * k->bytesPerPixel,
+                 mask + y * width / 8, 0, width);
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+int main()
+{
+  srand(1);
+  int failed = 0;
+
+  const PixelKernel* k;
+  for (k = pixelKernels(); k->name; k++) {
+    const PixelKernel* c = plainKernel(k->bytesPerPixel);
+    if (k == c) continue;
+    if (checkKernel(k, c))
+      printf("%-4s %d bytes per pixel: same as C\n", k->name,
+             k->bytesPerPixel);
+    else
+      failed++;
+  }
+
+  U8* frame = new U8[width * height * 4];
+  U8* src = new U8[width * height * 4];
+  U8* randomMask = new U8[width * height / 8];
+  U8* runMask = new U8[width * height / 8];
+  randomBytes(src, width * height * 4);
+  makeMask(randomMask, width * height / 8, false);
+  makeMask(runMask, width * height / 8, true);
+
+  printf("\nms per %dx%d frame  fill    mask    mask (runs)\n", width, height);
+  for (k = pixelKernels(); k->name; k++) {
+    printf("%-4s %d bytes per pixel", k->name, k->bytesPerPixel);
+    if (k->fillRow)
+      printf("  %6.2f", timeFill(k, frame) * 1000);
+    else
+      printf("       -");
+    if (k->maskRow)
+      printf("  %6.2f  %6.2f\n", timeMask(k, frame, src, randomMask) * 1000,
+             timeMask(k, frame, src, runMask) * 1000);
+    else
+      printf("       -       -\n");
+  }
+
+  delete [] frame;
+  delete [] src;
+  delete [] randomMask;
+  delete [] runMask;
+  return failed ? 1 : 0;
+}
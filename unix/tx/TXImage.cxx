@@ -23,30 +23,36 @@
 #include <time.h>
 #include <stdio.h>
 #include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <list>
+#include <vector>
 #include <rfb/TransImageGetter.h>
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
+#include <rfb/util.h>
 #include "TXWindow.h"
 #include "TXImage.h"
-#include <cairo.h>
-#include <cairo-xlib.h>
 using namespace rfb;
 
 static rfb::LogWriter vlog("TXImage");
 
+#define MAX_SCALE_THREADS 4
+
 TXImage::TXImage(Display* d, int width, int height, Visual* vis_, int depth_)
-  : xim(0), dpy(d), vis(vis_), depth(depth_), shminfo(0), tig(0), cube(0), inited(false)
+  : xim(0), dpy(d), vis(vis_), depth(depth_), shminfo(0), tig(0), cube(0),
+    shmPutSeq(0), haveRender(false), scaledWidth(0), scaledHeight(0),
+    scaleFilter(strDup(FilterBest)), scaleMethod(strDup("auto")),
+    filterMargin(0), scalerCreated(false), renderScaler(false),
+    cpuScaler(0), ximScaled(0), scaledShminfo(0)
 {
   width_ = width;
   height_ = height;
-    w_scale_rate = (double)w_scaled/width_;
-    h_scale_rate = (double)h_scaled/height_;
   for (int i = 0; i < 256; i++)
     colourMap[i].r = colourMap[i].g = colourMap[i].b = 0;
 
@@ -55,35 +61,35 @@ TXImage::TXImage(Display* d, int width, int height, Visual* vis_, int depth_)
   if (!depth)
     depth = DefaultDepth(dpy,DefaultScreen(dpy));
 
+  int eventBase, errorBase;
+  haveRender = (XRenderQueryExtension(dpy, &eventBase, &errorBase) &&
+                XRenderFindVisualFormat(dpy, vis));
+
   createXImage();
   getNativePixelFormat(vis, depth);
   colourmap = this;
   format.bpp = 0;  // just make it different to any valid format, so that...
   setPF(nativePF); // ...setPF() always works
-
-
-//  fprintf(stderr, "TED__TXImage::TXImage --> create pixmap and picture ori(%d, %d) -- scaled(%d, %d)\n",
-//          width_, height_, w_scaled, h_scaled);
-
 }
 
 TXImage::~TXImage()
 {
   if (data != (rdr::U8*)xim->data) delete [] data;
   destroyXImage();
+  destroyScaler();
   delete tig;
   delete cube;
-  XFreePixmap(dpy, pixmap_src);
-  XFreePixmap(dpy, pixmap_dst);
-  XRenderFreePicture(dpy, picture_src);
-  XRenderFreePicture(dpy, picture_dst);
+  delete [] scaleFilter;
+  delete [] scaleMethod;
 }
 
 void TXImage::resize(int w, int h)
 {
-  fprintf(stderr, "TED__TXImage::resize --> input(%d, %d)\n", w, h);
   if (w == width() && h == height()) return;
 
+  // The scale factors depend on the image size, so start scaling afresh.
+  destroyScaler();
+
   int oldStrideBytes = getStride() * (format.bpp/8);
   int rowsToCopy = __rfbmin(h, height());
   int bytesPerRow = __rfbmin(w, width()) * (format.bpp/8);
@@ -146,53 +152,166 @@ void TXImage::put(Window win, GC gc, const rfb::Rect& r)
   if (r.is_empty()) return;
   int x = r.tl.x;
   int y = r.tl.y;
-  int w = r.width();
-  int h = r.height();
-  fprintf(stderr, "\nTED__TXImage::put --> rect(%d, %d, %d, %d)\n", x, y, w, h);
   if (data != (rdr::U8*)xim->data) {
+    waitForShmPut(&shmInFlight, r);
     rdr::U8* ximDataStart = ((rdr::U8*)xim->data + y * xim->bytes_per_line
                              + x * (xim->bits_per_pixel / 8));
     tig->getImage(ximDataStart, r,
                   xim->bytes_per_line / (xim->bits_per_pixel / 8));
   }
-  // scale xim to xim_scaled
-//  if(w > 100){
-//    fprintf(stderr, "TED__TXImage::put --> rect(%d, %d: %d, %d)\n", x, y, w, h);
-//  }
-
-  static int mod = 60;
-  static int draw = 1;
-  static int k = 1;
-  struct timeval tv;
-  struct timezone tz;
-  gettimeofday(&tv, &tz);
- // fprintf(stderr, "TED__TXImage::scaleXImage begin at(%d.%d)...%d\n", tv.tv_sec%mod, tv.tv_usec, k++);
-
-  int x_scaled_src, y_scaled_src, x_scaled_dst, y_scaled_dst, r_w_scaled, r_h_scaled;
-
-  scaleXImage(win, gc, x, y, x, y, w, h, &x_scaled_src, &y_scaled_src, &x_scaled_dst, &y_scaled_dst, &r_w_scaled, &r_h_scaled);
-//
-//  if ((draw++)%mod == 0)
-//  {
-//      fprintf(stderr, "TED__TXImage::XCopyArea(%d.%d)...%d\n", w_scaled, h_scaled, draw);
-//     // XCopyArea(dpy, pixmap_dst, win, gc, 0, 0, w_scaled, h_scaled, 0, 0);
-//      draw = 1;
-//  }
 
+  if (!scaling()) {
+    putXImage(xim, shminfo, &shmInFlight, win, gc, r);
+    return;
+  }
+
+  if (!scalerCreated) {
+    createScaler(win, gc);
+    return;
+  }
+
+  // The CPU scaler reads straight from the XImage, so only RENDER needs the
+  // changes uploading.
+  if (!cpuScaler)
+    putXImage(xim, shminfo, &shmInFlight, pixmapSrc, gc, r);
+  scaleDamage.assign_union(rfb::Region(r));
+}
+
+// putXImage() draws a rectangle of an XImage onto a window or pixmap.  A
+// shared memory put only passes a reference to the segment, so the scaled
+// path costs no more than the unscaled one to get the pixels into the server.
+
+void TXImage::putXImage(XImage* image, XShmSegmentInfo* shm,
+                        rfb::Region* inFlight, Drawable d, GC gc,
+                        const rfb::Rect& r)
+{
+  int x = r.tl.x;
+  int y = r.tl.y;
+  if (shm) {
+    shmPutSeq = NextRequest(dpy);
+    XShmPutImage(dpy, d, gc, image, x, y, x, y, r.width(), r.height(), True);
+    inFlight->assign_union(rfb::Region(r));
+  } else {
+    XPutImage(dpy, d, gc, image, x, y, x, y, r.width(), r.height());
+  }
+}
+
+// The completion events themselves are just discarded by TXWindow's event
+// dispatch - it's the sequence number they carry which matters.  If the last
+// put hasn't been acknowledged, we pick up any events which have arrived
+// without blocking, and only make a round trip when we really must wait.
+
+bool TXImage::shmPutPending()
+{
+  if (shmInFlight.is_empty() && scaledInFlight.is_empty()) return false;
+  if ((long)(LastKnownRequestProcessed(dpy) - shmPutSeq) < 0)
+    XEventsQueued(dpy, QueuedAfterFlush);
+  if ((long)(LastKnownRequestProcessed(dpy) - shmPutSeq) < 0)
+    return true;
+  shmInFlight.clear();
+  scaledInFlight.clear();
+  return false;
+}
+
+void TXImage::waitForShmPut(rfb::Region* inFlight, const rfb::Rect& r)
+{
+  if (inFlight->intersect(r).is_empty()) return;
+  if (shmPutPending())
+    XSync(dpy, False);
+  shmInFlight.clear();
+  scaledInFlight.clear();
+}
+
+rdr::U8* TXImage::getPixelsRW(const rfb::Rect& r, int* stride)
+{
+  if (data == (rdr::U8*)xim->data)
+    waitForShmPut(&shmInFlight, r);
+  return FullFramePixelBuffer::getPixelsRW(r, stride);
+}
+
+void TXImage::setScaledSize(int w, int h)
+{
+  if (w <= 0 || h <= 0) w = h = 0;
+  if (w == scaledWidth && h == scaledHeight) return;
+  destroyScaler();
+  scaledWidth = w;
+  scaledHeight = h;
+}
+
+void TXImage::setScaleFilter(const char* filter)
+{
+  if (strcasecmp(filter, scaleFilter) == 0) return;
+  destroyScaler();
+  delete [] scaleFilter;
+  scaleFilter = strDup(filter);
+}
 
-//    XCopyArea(dpy, pixmap_dst, win, gc, x_scaled_src, y_scaled_src, w_scaled, h_scaled, x_scaled_dst, y_scaled_dst);
+void TXImage::setScaleMethod(const char* method)
+{
+  if (strcasecmp(method, scaleMethod) == 0) return;
+  destroyScaler();
+  delete [] scaleMethod;
+  scaleMethod = strDup(method);
+}
 
-//    scaleXImageCairo(win, gc, x, y, x, y, w, h);
-  //fprintf(stderr, "TED__TXImage::put --> xim(%d, %d) -- xim_scaled(%d, %d)\n", w, h, w_scaled, h_scaled);
+// flushScaled() works out which parts of the scaled image are affected by the
+// changed parts of the source image, scales just those parts, and draws them
+// on the window.  The source rectangles are widened by the filter margin
+// first, because a filtered destination pixel depends on its neighbours too.
+
+void TXImage::flushScaled(Window win, GC gc)
+{
+  if (!scalerCreated || scaleDamage.is_empty()) return;
+
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+  rfb::Region scaled;
+  scaleDamage.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (cpuScaler)
+      scaled.assign_union(rfb::Region(cpuScaler->scaledRect(*i)));
+    else
+      scaled.assign_union(rfb::Region(scaledRect(*i)));
+  }
+  scaleDamage.clear();
+
+  scaled.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (cpuScaler) {
+      waitForShmPut(&scaledInFlight, *i);
+      scaleCpu(*i);
+      putXImage(ximScaled, scaledShminfo, &scaledInFlight, win, gc, *i);
+      continue;
+    }
+    // With a transform on the source picture, the source coordinates are in
+    // the same (scaled) space as the destination ones.
+    XRenderComposite(dpy, PictOpSrc, pictureSrc, None, pictureDst,
+                     i->tl.x, i->tl.y, 0, 0, i->tl.x, i->tl.y,
+                     i->width(), i->height());
+    XCopyArea(dpy, pixmapDst, win, gc, i->tl.x, i->tl.y,
+              i->width(), i->height(), i->tl.x, i->tl.y);
+  }
+}
 
-//  if (usingShm()) {
-//    XShmPutImage(dpy, win, gc, xim_scaled, x_scaled_src, y_scaled_src, x_scaled_dst, y_scaled_dst, w_scaled, h_scaled, False);
-//  } else {
-//    fprintf(stderr, "TED__TXImage::put --> XPutImage(%d, %d, %d, %d: %d, %d)\n",
-//            x_scaled_src, y_scaled_src, x_scaled_dst, y_scaled_dst, w_scaled, h_scaled);
-//    XPutImage(dpy, win, gc, xim_scaled, x_scaled_src, y_scaled_src, x_scaled_dst, y_scaled_dst, w_scaled, h_scaled);
-    //XPutImage(dpy, win, gc, xim, x,y,x,y, w,h);
-//  }
+void TXImage::putScaled(Window win, GC gc, const rfb::Rect& r)
+{
+  if (!scaling()) {
+    put(win, gc, r.intersect(getRect()));
+    return;
+  }
+  if (!scalerCreated) {
+    createScaler(win, gc);
+    flushScaled(win, gc);
+    return;
+  }
+  Rect sr = r.intersect(Rect(0, 0, scaledWidth, scaledHeight));
+  if (sr.is_empty()) return;
+  if (cpuScaler) {
+    putXImage(ximScaled, scaledShminfo, &scaledInFlight, win, gc, sr);
+    return;
+  }
+  XCopyArea(dpy, pixmapDst, win, gc, sr.tl.x, sr.tl.y,
+            sr.width(), sr.height(), sr.tl.x, sr.tl.y);
 }
 
 void TXImage::setColourMapEntries(int firstColour, int nColours, rdr::U16* rgbs)
@@ -238,11 +357,37 @@ static TXImageCleanup imageCleanup;
 
 void TXImage::createXImage()
 {
+  xim = newXImage(width(), height(), &shminfo);
+  updateCleanup();
+}
+
+void TXImage::destroyXImage()
+{
+  // The X server has its own attachment to the segment, so there's no need to
+  // wait for any puts to finish before detaching from it.
+  shmInFlight.clear();
+  freeXImage(&xim, &shminfo);
+  updateCleanup();
+}
+
+// The images are deleted at exit if they have shared memory segments, so that
+// the segments get removed.
+
+void TXImage::updateCleanup()
+{
+  imageCleanup.images.remove(this);
+  if (shminfo || scaledShminfo)
+    imageCleanup.images.push_back(this);
+}
+
+XImage* TXImage::newXImage(int w, int h, XShmSegmentInfo** shmp)
+{
+  XImage* xim;
+
   if (XShmQueryExtension(dpy)) {
-    shminfo = new XShmSegmentInfo;
+    XShmSegmentInfo* shminfo = new XShmSegmentInfo;
 
-    xim = XShmCreateImage(dpy, vis, depth, ZPixmap,
-                          0, shminfo, width(), height());
+    xim = XShmCreateImage(dpy, vis, depth, ZPixmap, 0, shminfo, w, h);
 
     if (xim) {
       shminfo->shmid = shmget(IPC_PRIVATE,
@@ -263,8 +408,8 @@ void TXImage::createXImage()
 
           if (!caughtError) {
             vlog.debug("Using shared memory XImage");
-            imageCleanup.images.push_back(this);
-            return;
+            *shmp = shminfo;
+            return xim;
           }
 
           shmdt(shminfo->shmaddr);
@@ -286,32 +431,33 @@ void TXImage::createXImage()
     }
 
     delete shminfo;
-    shminfo = 0;
   }
 
+  *shmp = 0;
   xim = XCreateImage(dpy, vis, depth, ZPixmap,
-                     0, 0, width(), height(), BitmapPad(dpy), 0);
+                     0, 0, w, h, BitmapPad(dpy), 0);
 
   xim->data = (char*)malloc(xim->bytes_per_line * xim->height);
   if (!xim->data) {
     vlog.error("malloc failed");
     exit(1);
   }
+  return xim;
 }
 
-void TXImage::destroyXImage()
+void TXImage::freeXImage(XImage** ximp, XShmSegmentInfo** shmp)
 {
+  XShmSegmentInfo* shminfo = *shmp;
   if (shminfo) {
     vlog.debug("Freeing shared memory XImage");
     shmdt(shminfo->shmaddr);
     shmctl(shminfo->shmid, IPC_RMID, 0);
     delete shminfo;
-    shminfo = 0;
-    imageCleanup.images.remove(this);
+    *shmp = 0;
   }
   // XDestroyImage() will free(xim->data) if appropriate
-  if (xim) XDestroyImage(xim);
-  xim = 0;
+  if (*ximp) XDestroyImage(*ximp);
+  *ximp = 0;
 }
 
 
@@ -386,289 +532,213 @@ void TXImage::getNativePixelFormat(Visual* vis, int depth)
     }
   }
 }
-// scale xim to xim_scaled
-void TXImage::scaleXImage(Window win, GC gc,
-                          int x_src, int y_src, int x_dst, int y_dst, int w_src, int h_src,
-                          int *x_scaled_src, int *y_scaled_src, int *x_scaled_dst, int *y_scaled_dst, int *w_dst, int *h_dst)
-{
-  if(!inited)
-  {
-    rect_to_wrap = {0};
-    fprintf(stderr, "TED__TXImage::scaleXImage --> init to create pixmap and picture ori(%d, %d) -- scaled(%d, %d)"\
-                        " -- rate(%lf, %lf)\n", width_, height_, w_scaled, h_scaled, w_scale_rate, h_scale_rate);
-    XRenderPictFormat* format = XRenderFindVisualFormat(dpy, vis);
-    pixmap_src = XCreatePixmap(dpy, win, width_, height_, format->depth);
-    picture_src = XRenderCreatePicture(dpy, pixmap_src, format, 0, NULL);
-    pixmap_dst = XCreatePixmap(dpy, win, w_scaled, h_scaled, format->depth);
-    picture_dst = XRenderCreatePicture(dpy, pixmap_dst, format, 0, NULL);
-
-    XTransform xform = { {
-                               { XDoubleToFixed(1/w_scale_rate), XDoubleToFixed(0), XDoubleToFixed(0) },
-                               { XDoubleToFixed(0), XDoubleToFixed(1/h_scale_rate), XDoubleToFixed(0) },
-                               { XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(1) }
-                       }
-    };
-    XRenderSetPictureTransform(dpy, picture_src, &xform);
-    XRenderSetPictureFilter(dpy, picture_src, FilterBest, NULL, 0);
-
-    gettimeofday(&tv, NULL);
-    tv_end = {0};
-    inited = true;
 
+// createScaler() sets up scaling using RENDER, the CPU, or whichever of the
+// two turns out to be quicker at scaling the whole image.  RENDER is fast when
+// the X server accelerates it, but can be very slow on servers which don't
+// (Xvfb, Xvnc or a remote display), in which case we do better ourselves.
 
-  }
-    addRectToWrapRect(x_src, y_src, w_src, h_src);
-    XPutImage(dpy, pixmap_src, gc, xim, x_src, y_src, x_dst, y_dst, w_src, h_src);
-
-
-    fprintf(stderr, "TED__TXImage::scaleXImage ----> tv_end(%d)-tv(%d)=(%d)\n",
-             tv_end.tv_usec, tv.tv_usec, (tv_end.tv_usec - tv.tv_usec));
-
-    gettimeofday(&tv_end, NULL);
-
-    static int draw = 1;
-    static int mod = 20;
-    static int k = 1;
-
-    if ((tv_end.tv_usec - tv.tv_usec) >= 30 * 1000 || (tv.tv_usec - tv_end.tv_usec) >= 30 * 1000)
-    {
-        fprintf(stderr, "TED__TXImage::scaleXImage ----> "\
-        "rect_to_wrap(x_start=%d, y_start=%d, w=%d, h=%d, x_end=%d, y=end%d)\n",
-                rect_to_wrap.x_left_top,
-                rect_to_wrap.y_left_top,
-                rect_to_wrap.w,
-                rect_to_wrap.h,
-                rect_to_wrap.x_right_bottom,
-                rect_to_wrap.y_right_bottom);
-
-        WrapRect rect_to_scale = getRectToScale();
-        WrapRect rect_scaled = getScaledRect(&rect_to_scale);
-        WrapRect rect_to_draw = getScaledRect(&rect_to_wrap);
-
-        fprintf(stderr, "TED__TXImage::scaleXImage ----> "\
-        "rect_to_scale(x_start=%d, y_start=%d, w=%d, h=%d, x_end=%d, y=end%d)\n",
-                rect_to_scale.x_left_top,
-                rect_to_scale.y_left_top,
-                rect_to_scale.w,
-                rect_to_scale.h,
-                rect_to_scale.x_right_bottom,
-                rect_to_scale.y_right_bottom);
-
-        fprintf(stderr, "TED__TXImage::scaleXImage ----> "\
-        "rect_scaled(x_start=%d, y_start=%d, w=%d, h=%d, x_end=%d, y=end%d)\n",
-                rect_scaled.x_left_top,
-                rect_scaled.y_left_top,
-                rect_scaled.w,
-                rect_scaled.h,
-                rect_scaled.x_right_bottom,
-                rect_scaled.y_right_bottom);
-
-        fprintf(stderr, "TED__TXImage::scaleXImage ----> "\
-        "rect_to_draw(x_start=%d, y_start=%d, w=%d, h=%d, x_end=%d, y=end%d)\n",
-                rect_to_draw.x_left_top,
-                rect_to_draw.y_left_top,
-                rect_to_draw.w,
-                rect_to_draw.h,
-                rect_to_draw.x_right_bottom,
-                rect_to_draw.y_right_bottom);
-        XRenderComposite(dpy,
-                         PictOpSrc,
-                         picture_src,
-                         None,
-                         picture_dst,
-                         rect_to_scale.x_left_top,
-                         rect_to_scale.y_left_top,
-                         0,
-                         0,
-                         rect_scaled.x_left_top,
-                         rect_scaled.y_left_top,
-                         rect_scaled.w,
-                         rect_scaled.h);
-        //fprintf(stderr, "TED__TXImage::XCopyArea(%d.%d)...%d\n", w_scaled, h_scaled, k);
-        fprintf(stderr, "TED__TXImage::XCopyArea -----------------> wrap_r(%d, %d, %d, %d:  %d, %d)\n",
-                rect_scaled.x_left_top,
-                rect_scaled.y_left_top,
-                rect_scaled.w,
-                rect_scaled.h,
-                rect_scaled.x_left_top,
-                rect_scaled.y_left_top);
-//        if(rect_scaled.y_right_bottom > 560)
-//           fprintf(stderr, "TED__ ########## >>>>>560:(%d)\n\n\n\n\n\n\n\n", rect_scaled.y_right_bottom);
-//        XCopyArea(dpy,
-//                  pixmap_dst,
-//                  win,
-//                  gc,
-//                  rect_scaled.x_left_top,
-//                  rect_scaled.y_left_top,
-//                  rect_scaled.w,
-//                  rect_scaled.h,
-//                  rect_scaled.x_left_top,
-//                  rect_scaled.y_left_top);
-
-
-        XCopyArea(dpy,
-                  pixmap_dst,
-                  win,
-                  gc,
-                  0,
-                  0,
-                  w_scaled,
-                  h_scaled,
-                  0,
-                  0);
-        draw = 1;
-        rect_to_wrap = {0};
-        tv = tv_end;
+void TXImage::createScaler(Drawable d, GC gc)
+{
+  bool render = haveRender && strcasecmp(scaleMethod, "cpu") != 0;
+  bool cpu = !render || strcasecmp(scaleMethod, "render") != 0;
+
+  if (render)
+    createRenderScaler(d, gc);
+  if (cpu)
+    createCpuScaler();
+  scalerCreated = true;
+
+  if (render && cpu) {
+    int renderTime = timeScaler(false, d, gc);
+    int cpuTime = timeScaler(true, d, gc);
+    vlog.info("scaling the whole desktop takes %dms with RENDER, "
+              "%dms on the CPU (%s)", renderTime / 1000, cpuTime / 1000,
+              ImageScaler::simdName());
+    if (cpuTime < renderTime) {
+      destroyRenderScaler();
+    } else {
+      destroyCpuScaler();
     }
+  }
 
+  vlog.info("scaling %dx%d to %dx%d using %s", width(), height(),
+            scaledWidth, scaledHeight, cpuScaler ? "the CPU" : "RENDER");
+  scaleDamage.reset(getRect());
+}
 
+// timeScaler() returns the best of a few attempts at scaling and drawing the
+// whole image, in microseconds.
 
-  //XCopyArea(dpy, pixmap_dst, win, gc, x_scaled_src, y_scaled_src, w_scaled, h_scaled, x_scaled_dst, y_scaled_dst);
-//  gettimeofday(&tv, &tz);
-//  fprintf(stderr, "TED__TXImage::scaleXImage finish composite at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
-
-
-//  xim_scaled = XGetImage(dpy,
-//                            dst_pixmap,
-//                            0,
-//                            0,
-//                            w_scaled,
-//                            h_scaled,
-//                            AllPlanes, ZPixmap);
-//
-//  gettimeofday(&tv, &tz);
-//  fprintf(stderr, "TED__TXImage::scaleXImage finish XCopyArea at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
-
-
-
-//  gettimeofday(&tv, &tz);
-//  fprintf(stderr, "TED__TXImage::scaleXImage finish cleanup at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
+int TXImage::timeScaler(bool cpu, Drawable d, GC gc)
+{
+  Rect r(0, 0, scaledWidth, scaledHeight);
+  int best = 0;
+  for (int i = 0; i < 3; i++) {
+    struct timeval start, end;
+    XSync(dpy, False);
+    gettimeofday(&start, 0);
+    if (cpu) {
+      scaleCpu(r);
+      putXImage(ximScaled, scaledShminfo, &scaledInFlight, d, gc, r);
+    } else {
+      XRenderComposite(dpy, PictOpSrc, pictureSrc, None, pictureDst,
+                       0, 0, 0, 0, 0, 0, scaledWidth, scaledHeight);
+      XCopyArea(dpy, pixmapDst, d, gc, 0, 0, scaledWidth, scaledHeight, 0, 0);
+    }
+    XSync(dpy, False);
+    gettimeofday(&end, 0);
+    int us = ((end.tv_sec - start.tv_sec) * 1000000 +
+              (end.tv_usec - start.tv_usec));
+    if (i == 0 || us < best) best = us;
+  }
+  return best;
 }
 
-void TXImage::scaleXImageCairo(Window win, GC gc, int x_src, int y_src, int x_dst, int y_dst, int w_src, int h_src)
+void TXImage::createRenderScaler(Drawable d, GC gc)
 {
-
-  int mod = 60;
-
-  struct timeval tv;
-  struct timezone tz;
-  gettimeofday(&tv, &tz);
-  fprintf(stderr, "TED__TXImage::scaleXImageCairo begin at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
-
   XRenderPictFormat* format = XRenderFindVisualFormat(dpy, vis);
-  Pixmap src_pixmap = XCreatePixmap(dpy,
-                                    win,
-                                    width_,
-                                    height_,
-                                    format->depth);
-
-  gettimeofday(&tv, &tz);
-  fprintf(stderr, "TED__TXImage::scaleXImageCairo finish createPixmap at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
-
-  XPutImage(dpy, src_pixmap, gc, xim, x_src, y_src, x_dst, y_dst, w_src, h_src);
-
-  gettimeofday(&tv, &tz);
-  fprintf(stderr, "TED__TXImage::scaleXImageCairo finish putimage at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
-
-  cairo_surface_t *sfc_src = cairo_xlib_surface_create(dpy, src_pixmap, vis, width_, height_);
-  cairo_surface_t *sfc_dst = cairo_xlib_surface_create(dpy, win, vis, w_scaled, h_scaled);
-  cairo_t *ct = cairo_create(sfc_dst);
-  cairo_scale(ct, (double)w_scaled/width_, (double)h_scaled/height_);
-  cairo_set_source_surface(ct, sfc_src, 0, 0);
-  cairo_paint(ct);
-
-  gettimeofday(&tv, &tz);
-  fprintf(stderr, "TED__TXImage::scaleXImageCairo finish cairo at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
-
-  XFreePixmap(dpy, src_pixmap);
-  cairo_surface_destroy(sfc_src);
-  cairo_surface_destroy(sfc_dst);
-  cairo_destroy(ct);
+  pixmapSrc = XCreatePixmap(dpy, d, width(), height(), depth);
+  pictureSrc = XRenderCreatePicture(dpy, pixmapSrc, format, 0, 0);
+  pixmapDst = XCreatePixmap(dpy, d, scaledWidth, scaledHeight, depth);
+  pictureDst = XRenderCreatePicture(dpy, pixmapDst, format, 0, 0);
+
+  XTransform xform = { {
+    { XDoubleToFixed((double)width() / scaledWidth), 0, 0 },
+    { 0, XDoubleToFixed((double)height() / scaledHeight), 0 },
+    { 0, 0, XDoubleToFixed(1) }
+  } };
+  XRenderSetPictureTransform(dpy, pictureSrc, &xform);
+  XRenderSetPictureFilter(dpy, pictureSrc, scaleFilter, 0, 0);
+
+  // The filter margin is the distance in source pixels over which the filter
+  // gathers; when shrinking, the "good" and "best" filters may average over a
+  // whole scaled pixel's worth of source pixels.
+  if (strcasecmp(scaleFilter, FilterNearest) == 0 ||
+      strcasecmp(scaleFilter, FilterFast) == 0 ||
+      strcasecmp(scaleFilter, FilterBilinear) == 0) {
+    filterMargin = 1;
+  } else {
+    filterMargin = 1 + __rfbmax((width() + scaledWidth - 1) / scaledWidth,
+                                (height() + scaledHeight - 1) / scaledHeight);
+  }
 
-  gettimeofday(&tv, &tz);
-  fprintf(stderr, "TED__TXImage::scaleXImageCairo finish cleanup at(%d.%d)\n", tv.tv_sec%mod, tv.tv_usec);
+  putXImage(xim, shminfo, &shmInFlight, pixmapSrc, gc, getRect());
+  renderScaler = true;
 }
 
-void TXImage::addRectToWrapRect(int x_, int y_, int w_, int h_)
+void TXImage::destroyRenderScaler()
 {
-   // fprintf(stderr, "TED__TXImage::addRectToWrapRect --> r(%d, %d, %d, %d)\n", x_, y_, w_, h_);
-    int x_right_bottom_ = x_ + w_;
-    int y_right_bottom_ = y_ + h_;
-
-    // add the first rect
-    if(rect_to_wrap.y_right_bottom == 0)
-    {
-        rect_to_wrap.x_left_top = x_;
-        rect_to_wrap.y_left_top = y_;
-        rect_to_wrap.x_right_bottom = x_right_bottom_;
-        rect_to_wrap.y_right_bottom = y_right_bottom_;
-    }
-    else
-    {
-        // calculate the wrapped rect size
-        rect_to_wrap.x_left_top = x_ < rect_to_wrap.x_left_top ? x_ : rect_to_wrap.x_left_top;
-        rect_to_wrap.y_left_top = y_ < rect_to_wrap.y_left_top ? y_ : rect_to_wrap.y_left_top;
-        rect_to_wrap.x_right_bottom = x_right_bottom_ > rect_to_wrap.x_right_bottom ? x_right_bottom_ : rect_to_wrap.x_right_bottom;
-        rect_to_wrap.y_right_bottom = y_right_bottom_ > rect_to_wrap.y_right_bottom ? y_right_bottom_ : rect_to_wrap.y_right_bottom;
-    }
-    //fprintf(stderr, "TED__TXImage::addRectToWrapRect --> wrap_r(%d, %d, %d, %d)\n\n",
-//            rect_to_wrap.x_left_top,
-//            rect_to_wrap.y_left_top,
-//            rect_to_wrap.x_right_bottom,
-//            rect_to_wrap.y_right_bottom);
+  if (!renderScaler) return;
+  XRenderFreePicture(dpy, pictureSrc);
+  XRenderFreePicture(dpy, pictureDst);
+  XFreePixmap(dpy, pixmapSrc);
+  XFreePixmap(dpy, pixmapDst);
+  renderScaler = false;
 }
 
-WrapRect TXImage::getRectToScale()
-{
-//    //fprintf(stderr, "TED__TXImage::getRectToScale --> wrap_r(%d, %d, %d, %d)\n",
-//            rect_to_wrap.x_left_top,
-//            rect_to_wrap.y_left_top,
-//            rect_to_wrap.x_right_bottom,
-//            rect_to_wrap.y_right_bottom);
-    //extend 'rect_to_wrap' ${extend} pix.
-    WrapRect ret_rect = {0};
-    ret_rect.x_left_top = (rect_to_wrap.x_left_top - extend) > 0 ? (rect_to_wrap.x_left_top - extend) : 0;
-    ret_rect.y_left_top = (rect_to_wrap.y_left_top - extend) > 0 ? (rect_to_wrap.y_left_top - extend) : 0;
-    ret_rect.x_right_bottom = (rect_to_wrap.x_right_bottom + extend) < width_ ?  (rect_to_wrap.x_right_bottom + extend) :width_;
-    ret_rect.y_right_bottom = (rect_to_wrap.y_right_bottom + extend) < height_ ?  (rect_to_wrap.y_right_bottom + extend) :height_;
-
-   // fprintf(stderr, "TED__TXImage::getRectToScale --> to_scale_r(%d, %d, %d, %d)\n\n",
-//            ret_rect.x_left_top,
-//            ret_rect.y_left_top,
-//            ret_rect.x_right_bottom,
-//            ret_rect.y_right_bottom);
+// The CPU scaler averages over boxes when the pixels have 8-bit channels, or
+// blends neighbouring pixels if asked for a "bilinear" filter.  Otherwise (or
+// if asked for a "nearest" or "fast" filter) it picks the nearest pixel.
 
-    return ret_rect;
+void TXImage::createCpuScaler()
+{
+  ImageScaler::Filter filter = ImageScaler::box;
+  if (strcasecmp(scaleFilter, FilterBilinear) == 0)
+    filter = ImageScaler::bilinear;
+  if (strcasecmp(scaleFilter, FilterNearest) == 0 ||
+      strcasecmp(scaleFilter, FilterFast) == 0 ||
+      !nativePF.trueColour || nativePF.redMax != 255 ||
+      nativePF.greenMax != 255 || nativePF.blueMax != 255)
+    filter = ImageScaler::nearest;
+
+  cpuScaler = new ImageScaler;
+  cpuScaler->init(width(), height(), scaledWidth, scaledHeight,
+                  xim->bits_per_pixel, filter);
+  ximScaled = newXImage(scaledWidth, scaledHeight, &scaledShminfo);
+  updateCleanup();
 }
 
-WrapRect TXImage::getScaledRect(WrapRect *ptr_rect) const
+void TXImage::destroyCpuScaler()
 {
-    int w_ = ptr_rect->x_right_bottom - ptr_rect->x_left_top;
-    int h_ = ptr_rect->y_right_bottom - ptr_rect->y_left_top;
-
-    //fprintf(stderr, "TED__TXImage::getScaledRect --> ptr_rect(%d, %d,%d, %d)\n",
-//            ptr_rect-> x_left_top,
-//            ptr_rect-> y_left_top,
-//            w_,
-//            h_);
-
-
-    WrapRect ret_rect = {0};
-    ret_rect.x_left_top = (int)(ptr_rect->x_left_top * w_scale_rate);
-    ret_rect.y_left_top = (int) (ptr_rect->y_left_top * h_scale_rate);
-    ret_rect.w = (unsigned int) (w_ * w_scale_rate);
-    ret_rect.h = (unsigned int) (h_ * h_scale_rate);
+  if (!cpuScaler) return;
+  delete cpuScaler;
+  cpuScaler = 0;
+  scaledInFlight.clear();
+  freeXImage(&ximScaled, &scaledShminfo);
+  updateCleanup();
+}
 
-   // fprintf(stderr, "TED__TXImage::getScaledRect --> scaled_r(%d, %d:  %d, %d)\n",
-//            ret_rect.x_left_top,
-//            ret_rect.y_left_top,
-//            ret_rect.w,
-//            ret_rect.h);
-    return ret_rect;
+void TXImage::destroyScaler()
+{
+  if (!scalerCreated) return;
+  destroyRenderScaler();
+  destroyCpuScaler();
+  scaleDamage.clear();
+  scalerCreated = false;
 }
 
+// scaledRect() maps a rectangle of the image, widened by the filter margin,
+// to the rectangle of the scaled image which it affects.
 
+Rect TXImage::scaledRect(const Rect& r)
+{
+  Rect sr;
+  sr.tl.x = (r.tl.x - filterMargin) * scaledWidth / width();
+  sr.tl.y = (r.tl.y - filterMargin) * scaledHeight / height();
+  sr.br.x = ((r.br.x + filterMargin) * scaledWidth + width() - 1) / width();
+  sr.br.y = ((r.br.y + filterMargin) * scaledHeight + height() - 1) / height();
+  return sr.intersect(Rect(0, 0, scaledWidth, scaledHeight));
+}
 
+// scaleCpu() scales a rectangle of the image into ximScaled.  Big rectangles
+// are split into bands of rows, which are scaled in parallel.
 
+struct ScaleBand {
+  const ImageScaler* scaler;
+  XImage* src;
+  XImage* dst;
+  Rect r;
+};
 
+static void* scaleBand(void* arg)
+{
+  ScaleBand* band = (ScaleBand*)arg;
+  int bytesPerPixel = band->src->bits_per_pixel / 8;
+  band->scaler->scale(band->src->data,
+                      band->src->bytes_per_line / bytesPerPixel,
+                      band->dst->data,
+                      band->dst->bytes_per_line / bytesPerPixel, band->r);
+  return 0;
+}
 
+void TXImage::scaleCpu(const Rect& r)
+{
+  static int nCpus = 0;
+  if (!nCpus)
+    nCpus = __rfbmax(1, __rfbmin(MAX_SCALE_THREADS,
+                                 (int)sysconf(_SC_NPROCESSORS_ONLN)));
+
+  int nBands = __rfbmin(nCpus, r.height() / 16);
+  if (r.area() < 128 * 128 || nBands < 1)
+    nBands = 1;
+
+  ScaleBand bands[MAX_SCALE_THREADS];
+  pthread_t threads[MAX_SCALE_THREADS];
+  bool started[MAX_SCALE_THREADS];
+  for (int i = 0; i < nBands; i++) {
+    bands[i].scaler = cpuScaler;
+    bands[i].src = xim;
+    bands[i].dst = ximScaled;
+    bands[i].r = Rect(r.tl.x, r.tl.y + r.height() * i / nBands,
+                      r.br.x, r.tl.y + r.height() * (i + 1) / nBands);
+    started[i] = (i > 0 &&
+                  pthread_create(&threads[i], 0, scaleBand, &bands[i]) == 0);
+  }
+  for (int i = 0; i < nBands; i++) {
+    if (started[i])
+      pthread_join(threads[i], 0);
+    else
+      scaleBand(&bands[i]);
+  }
+}
@@ -39,21 +39,12 @@
 #include <rfb/PixelBuffer.h>
 #include <rfb/ColourMap.h>
 #include <rfb/ColourCube.h>
+#include <rfb/Region.h>
+#include <rfb/ImageScaler.h>
 #include <X11/extensions/XShm.h>
 
 namespace rfb { class TransImageGetter; }
 
-typedef struct WrapRect_
-{
-    int x_left_top;
-    int y_left_top;
-    int x_right_bottom;
-    int y_right_bottom;
-    unsigned int w;
-    unsigned int h;
-} WrapRect;
-
-
 class TXImage : public rfb::FullFramePixelBuffer, public rfb::ColourMap {
 public:
   TXImage(Display* dpy, int width, int height, Visual* vis=0, int depth=0);
@@ -62,9 +53,33 @@ public:
   // resize() resizes the image, preserving the image data where possible.
   void resize(int w, int h);
 
-  // put causes the given rectangle to be drawn onto the given window.
+  // put causes the given rectangle to be drawn onto the given window.  If a
+  // scaled size has been set, the rectangle is only uploaded to the X server
+  // and remembered, and is drawn scaled by the next call to flushScaled().
   void put(Window win, GC gc, const rfb::Rect& r);
 
+  // setScaledSize() sets the size at which the image is drawn in the window.
+  void setScaledSize(int w, int h);
+
+  // setScaleFilter() sets the RENDER filter used to scale the image, trading
+  // quality for speed - e.g. "nearest", "bilinear", "good" or "best".  When
+  // scaling on the CPU, "nearest" and "fast" pick the nearest pixel, and the
+  // others average all the pixels under each scaled pixel.
+  void setScaleFilter(const char* filter);
+
+  // setScaleMethod() chooses between scaling with "render" and on the "cpu".
+  // With "auto", both are timed and the quicker one is used.
+  void setScaleMethod(const char* method);
+
+  // flushScaled() scales those parts of the image which have changed since it
+  // was last called, and draws them onto the given window.
+  void flushScaled(Window win, GC gc);
+  bool scalePending() { return !scaleDamage.is_empty(); }
+
+  // putScaled() redraws the given rectangle of the window, which is in window
+  // coordinates, from the last scaled image.
+  void putScaled(Window win, GC gc, const rfb::Rect& r);
+
   // setColourMapEntries() changes some of the entries in the colourmap.
   // However these settings won't take effect until updateColourMap() is
   // called.  This is because recalculating the internal translation table can
@@ -73,45 +88,50 @@ public:
   void updateColourMap();
 
   bool usingShm() { return shminfo; }
+  bool scaling() { return scaledWidth; }
+
+  // shmPutPending() returns true if the X server may still be reading the
+  // shared memory image for a previous put.
+  bool shmPutPending();
 
   // PixelBuffer methods
   // width(), height(), getPF() etc are inherited from PixelBuffer
   virtual void setPF(const rfb::PixelFormat& pf);
   virtual int getStride() const;
-    const static int w_scaled = 1024;
-    const static int h_scaled = 768;
-
-private:
-
 
+  // getPixelsRW() waits until the X server has finished with any part of a
+  // shared memory image which is about to be written to.
+  virtual rdr::U8* getPixelsRW(const rfb::Rect& r, int* stride);
+  virtual const rdr::U8* getPixelsR(const rfb::Rect& r, int* stride) {
+    return FullFramePixelBuffer::getPixelsRW(r, stride);
+  }
 
+private:
 
   // ColourMap method
   virtual void lookup(int index, int* r, int* g, int* b);
 
   void createXImage();
   void destroyXImage();
+  XImage* newXImage(int w, int h, XShmSegmentInfo** shm);
+  void freeXImage(XImage** xim, XShmSegmentInfo** shm);
+  void updateCleanup();
   void getNativePixelFormat(Visual* vis, int depth);
-
-    void scaleXImage(Window win, GC gc, int x_src, int y_src, int x_dst, int y_dst, int w_src, int h_src,
-                     int *x_scaled_src, int *y_scaled_src, int *x_scaled_dst, int *y_scaled_dst, int *w_dst, int *h_dst);
-    void scaleXImageCairo(Window win, GC gc, int x_src, int y_src, int x_dst, int y_dst, int w_src, int h_src);
-    void addRectToWrapRect(int x, int y, int w, int h);
-    WrapRect getRectToScale();
-    WrapRect getScaledRect(WrapRect *ptr_rect) const;
-
-
-
-    XImage* xim;
-    Pixmap pixmap_src, pixmap_dst;
-    Picture picture_src, picture_dst;
-    struct timeval tv, tv_end;
-
-    WrapRect rect_to_wrap;
-    int extend = 5;
-    bool inited;
-    double w_scale_rate;
-    double h_scale_rate;
+  void putXImage(XImage* image, XShmSegmentInfo* shm, rfb::Region* inFlight,
+                 Drawable d, GC gc, const rfb::Rect& r);
+  void waitForShmPut(rfb::Region* inFlight, const rfb::Rect& r);
+
+  void createScaler(Drawable d, GC gc);
+  void destroyScaler();
+  int timeScaler(bool cpu, Drawable d, GC gc);
+  void createRenderScaler(Drawable d, GC gc);
+  void destroyRenderScaler();
+  void createCpuScaler();
+  void destroyCpuScaler();
+  void scaleCpu(const rfb::Rect& r);
+  rfb::Rect scaledRect(const rfb::Rect& r);
+
+  XImage* xim;
   Display* dpy;
   Visual* vis;
   int depth;
@@ -120,6 +140,33 @@ private:
   rfb::Colour colourMap[256];
   rfb::PixelFormat nativePF;
   rfb::ColourCube* cube;
+
+  // shmInFlight and scaledInFlight are the parts of the shared memory images
+  // which have been put but which the X server may not have read yet.  Puts
+  // ask for a completion event, whose arrival tells Xlib that the request
+  // numbered shmPutSeq has been processed.
+  rfb::Region shmInFlight;
+  rfb::Region scaledInFlight;
+  unsigned long shmPutSeq;
+
+  // With RENDER, the image is scaled by uploading it to pixmapSrc and
+  // compositing it into pixmapDst through a transform.  On the CPU, it is
+  // scaled into ximScaled, which is then put like the unscaled image.
+  // scaleDamage is the part of the image which has changed since the scaled
+  // image was last brought up to date.
+  bool haveRender;
+  int scaledWidth, scaledHeight;
+  char* scaleFilter;
+  char* scaleMethod;
+  int filterMargin;
+  bool scalerCreated;
+  bool renderScaler;
+  Pixmap pixmapSrc, pixmapDst;
+  Picture pictureSrc, pictureDst;
+  rfb::ImageScaler* cpuScaler;
+  XImage* ximScaled;
+  XShmSegmentInfo* scaledShminfo;
+  rfb::Region scaleDamage;
 };
 
 #endif
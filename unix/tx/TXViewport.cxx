@@ -25,7 +25,8 @@
 TXViewport::TXViewport(Display* dpy_, int w, int h, TXWindow* parent_)
   : TXWindow(dpy_, w, h, parent_), child(0), hScrollbar(0),
     vScrollbar(0), scrollbarSize(15), xOff(0), yOff(0), bumpScrollTimer(this),
-    bumpScroll(false), needScrollbars(false), bumpScrollX(0), bumpScrollY(0)
+    bumpScroll(false), needScrollbars(false), bumpScrollX(0), bumpScrollY(0),
+    cb(0)
 {
   fprintf(stderr, "TED__TXViewport::TXViewport --> clipper = new TXWindow of(%d, %d)\n", width(), height());
   clipper = new TXWindow(dpy, width(), height(),
@@ -75,6 +76,7 @@ bool TXViewport::setOffset(int x, int y)
     xOff = x;
     yOff = y;
     child->move(xOff, yOff);
+    if (cb) cb->viewportChanged(this);
     return true;
   }
 
@@ -112,6 +114,17 @@ bool TXViewport::bumpScrollEvent(XMotionEvent* ev)
   return false;
 }
 
+// The viewport itself may be smaller than the clipper, which is not always
+// resized to match it.
+
+rfb::Rect TXViewport::visibleRect()
+{
+  int w = __rfbmin(width(), clipper->width());
+  int h = __rfbmin(height(), clipper->height());
+  return rfb::Rect(-xOff, -yOff, w - xOff, h - yOff)
+    .intersect(rfb::Rect(0, 0, child->width(), child->height()));
+}
+
 bool TXViewport::handleTimeout(rfb::Timer* timer) {
   return setOffset(xOff + bumpScrollX, yOff + bumpScrollY);
 }
@@ -121,6 +134,7 @@ void TXViewport::resizeNotify()
   needScrollbars = (!bumpScroll &&
                     (width() < child->width() || height() < child->height()) &&
                     (width() > scrollbarSize && height() > scrollbarSize));
+  if (cb) cb->viewportChanged(this);
 //  fprintf(stderr, "TED__TXViewport::resizeNotify --> parent(%d, %d) --- child(%d, %d)\n",
 //          width(), height(), child->width(), child->height());
 
@@ -29,9 +29,12 @@
 #define __TXVIEWPORT_H__
 
 #include <rfb/Timer.h>
+#include <rfb/Rect.h>
 #include "TXWindow.h"
 #include "TXScrollbar.h"
 
+class TXViewportCallback;
+
 class TXViewport : public TXWindow, public TXScrollbarCallback,
                    public rfb::Timer::Callback {
 public:
@@ -59,6 +62,14 @@ public:
   // normally.
   bool bumpScrollEvent(XMotionEvent* ev);
 
+  // visibleRect() returns the part of the child window which can be seen in
+  // the viewport, in the child's coordinates.
+  rfb::Rect visibleRect();
+
+  // setCallback() sets the TXViewportCallback to tell whenever the part of
+  // the child which can be seen may have changed.
+  void setCallback(TXViewportCallback* cb_) { cb = cb_; }
+
 private:
   virtual void resizeNotify();
   virtual void scrollbarPos(int x, int y, TXScrollbar* sb);
@@ -73,5 +84,11 @@ private:
   bool bumpScroll;
   bool needScrollbars;
   int bumpScrollX, bumpScrollY;
+  TXViewportCallback* cb;
+};
+
+class TXViewportCallback {
+public:
+  virtual void viewportChanged(TXViewport* v)=0;
 };
 #endif
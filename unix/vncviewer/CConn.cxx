@@ -29,6 +29,7 @@
 #include <rfb/Hostname.h>
 #include <rfb/LogWriter.h>
 #include <rfb/util.h>
+#include <rfb/Region.h>
 #include <rfb/Password.h>
 #include <network/TcpSocket.h>
 
@@ -37,6 +38,7 @@
 #include "ServerDialog.h"
 #include "PasswdDialog.h"
 #include "parameters.h"
+#include "ThreadedInStream.h"
 
 using namespace rfb;
 
@@ -52,11 +54,13 @@ StringParameter windowName("name", "The X window name", "");
 CConn::CConn(Display* dpy_, int argc_, char** argv_, network::Socket* sock_,
              char* vncServerName, bool reverse)
   : dpy(dpy_), argc(argc_),
-    argv(argv_), serverHost(0), serverPort(0), sock(sock_), viewport(0),
+    argv(argv_), serverHost(0), serverPort(0), sock(sock_), threadedIn(0),
+    viewport(0),
     desktop(0), desktopEventHandler(0),
     currentEncoding(encodingZRLE), lastServerEncoding((unsigned int)-1),
     fullColour(::fullColour),
     autoSelect(::autoSelect), shared(::shared), formatChange(false),
+    updatesPaused(false), viewportMapped(false), desktopObscured(false),
     encodingChange(false), sameMachine(false), fullScreen(::fullScreen),
     ctrlDown(false), altDown(false),
     menuKeysym(0), menu(dpy, this), options(dpy, this), about(dpy), info(dpy),
@@ -76,6 +80,8 @@ CConn::CConn(Display* dpy_, int argc_, char** argv_, network::Socket* sock_,
   }
   cp.supportsDesktopResize = true;
   cp.supportsLocalCursor = useLocalCursor;
+  cp.supportsCursorPos = useLocalCursor;
+  cp.compressLevel = compressLevel;
   initMenu();
 
   if (sock) {
@@ -100,7 +106,12 @@ CConn::CConn(Display* dpy_, int argc_, char** argv_, network::Socket* sock_,
   sameMachine = sock->sameMachine();
   sock->inStream().setBlockCallback(this);
   setServerName(sock->getPeerEndpoint());
-  setStreams(&sock->inStream(), &sock->outStream());
+  if (readerThread) {
+    threadedIn = new ThreadedInStream(&sock->inStream(), this);
+    setStreams(threadedIn, &sock->outStream());
+  } else {
+    setStreams(&sock->inStream(), &sock->outStream());
+  }
   initialiseProtocol();
 }
 
@@ -108,6 +119,7 @@ CConn::~CConn() {
   free(serverHost);
   delete desktop;
   delete viewport;
+  delete threadedIn;
   delete sock;
 }
 
@@ -124,7 +136,8 @@ void CConn::deleteWindow(TXWindow* w) {
 // handleEvent() filters all events on the desktop and menu.  Most are passed
 // straight through.  The exception is the F8 key.  When pressed on the
 // desktop, it is used to bring up the menu.  An F8 press or release on the
-// menu is passed through as if it were on the desktop.
+// menu is passed through as if it were on the desktop.  Mapping and
+// visibility changes are also noted so that we only ask for what can be seen.
 
 void CConn::handleEvent(TXWindow* w, XEvent* ev)
 {
@@ -132,6 +145,22 @@ void CConn::handleEvent(TXWindow* w, XEvent* ev)
   char str[256];
 
   switch (ev->type) {
+  case MapNotify:
+  case UnmapNotify:
+    if (w == viewport) {
+      viewportMapped = (ev->type == MapNotify);
+      viewportChanged(viewport);
+      break;
+    }
+    goto forward;
+
+  case VisibilityNotify:
+    if (w == desktop) {
+      desktopObscured = (ev->xvisibility.state == VisibilityFullyObscured);
+      viewportChanged(viewport);
+    }
+    goto forward;
+
   case KeyPress:
   case KeyRelease:
     XLookupString(&ev->xkey, str, 256, &ks, NULL);
@@ -149,6 +178,7 @@ void CConn::handleEvent(TXWindow* w, XEvent* ev)
     // drop through
 
   default:
+  forward:
     if (w == desktop) {
 //      fprintf(stderr, "TED__CConn::handleXEvent --> default desktopEventHandler->handleEvent\n");
       desktopEventHandler->handleEvent(w, ev);
@@ -158,9 +188,11 @@ void CConn::handleEvent(TXWindow* w, XEvent* ev)
 }
 
 // blockCallback() is called when reading from the socket would block.  We
-// process X events until the socket is ready for reading again.
+// process X events until the socket is ready for reading again, or with a
+// reader thread, until it says there is data.
 
 void CConn::blockCallback() {
+  int fd = threadedIn ? threadedIn->getNotifyFd() : sock->getFd();
   fd_set rfds;
   do {
     struct timeval tv;
@@ -186,10 +218,32 @@ void CConn::blockCallback() {
     // Wait for X events, VNC traffic, or the next timer expiry
     FD_ZERO(&rfds);
     FD_SET(ConnectionNumber(dpy), &rfds);
-    FD_SET(sock->getFd(), &rfds);
+    FD_SET(fd, &rfds);
     int n = select(FD_SETSIZE, &rfds, 0, 0, tvp);
     if (n < 0) throw rdr::SystemException("select",errno);
-  } while (!(FD_ISSET(sock->getFd(), &rfds)));
+  } while (!(FD_ISSET(fd, &rfds)));
+}
+
+// The connection speed is timed by whichever stream reads from the socket.
+
+void CConn::startTiming() {
+  if (threadedIn) threadedIn->startTiming();
+  else sock->inStream().startTiming();
+}
+
+void CConn::stopTiming() {
+  if (threadedIn) threadedIn->stopTiming();
+  else sock->inStream().stopTiming();
+}
+
+unsigned int CConn::kbitsPerSecond() {
+  if (threadedIn) return threadedIn->kbitsPerSecond();
+  return sock->inStream().kbitsPerSecond();
+}
+
+unsigned int CConn::timeWaited() {
+  if (threadedIn) return threadedIn->timeWaited();
+  return sock->inStream().timeWaited();
 }
 
 
@@ -247,11 +301,22 @@ void CConn::serverInit() {
   desktop = new DesktopWindow(dpy, cp.width, cp.height, serverPF, this);
 
   desktopEventHandler = desktop->setEventHandler(this);
-  desktop->addEventMask(KeyPressMask | KeyReleaseMask);
+  desktop->addEventMask(KeyPressMask | KeyReleaseMask | VisibilityChangeMask);
   fullColourPF = desktop->getPF();
   if (!serverPF.trueColour)
     fullColour = true;
   recreateViewport();
+
+  // Ask the server to do most of the scaling, so that less has to be sent.
+  // It scales both ways by the same amount, so ask for just enough that the
+  // desktop is no smaller than the scaled size, and scale the rest here.
+  if (serverScaling && scaledWidth > 0 && scaledHeight > 0) {
+    int percent = __rfbmax((scaledWidth * 100 + cp.width - 1) / cp.width,
+                           (scaledHeight * 100 + cp.height - 1) / cp.height);
+    if (percent < 100)
+      cp.scalePercent = percent;
+  }
+
   formatChange = encodingChange = true;
   requestNewUpdate();
 }
@@ -263,9 +328,7 @@ void CConn::setDesktopSize(int w, int h) {
   CConnection::setDesktopSize(w,h);
 
   if (desktop) {
-//    w = w_scaled;
-//    h = h_scaled;
-//    fprintf(stderr, "TED__CCon::setDesktopSize --> set fixed size --- desktop->resize of(%d, %d)\n", w, h);
+    requestedRect = requestedRect.intersect(Rect(0, 0, w, h));
     desktop->resize(w, h);
     recreateViewport();
   }
@@ -312,7 +375,7 @@ void CConn::serverCutText(const char* str, int len) {
 // being slow or the network having high latency
 void CConn::beginRect(const Rect& r, unsigned int encoding)
 {
-  sock->inStream().startTiming();
+  startTiming();
   if (encoding != encodingCopyRect) {
     lastServerEncoding = encoding;
   }
@@ -320,7 +383,7 @@ void CConn::beginRect(const Rect& r, unsigned int encoding)
 
 void CConn::endRect(const Rect& r, unsigned int encoding)
 {
-  sock->inStream().stopTiming();
+  stopTiming();
   if (debugDelay != 0) {
     desktop->invertRect(r);
     debugRects.push_back(r);
@@ -338,10 +401,22 @@ void CConn::imageRect(const rfb::Rect& r, void* p) {
 void CConn::copyRect(const rfb::Rect& r, int sx, int sy) {
   desktop->copyRect(r,sx,sy);
 }
+// Pixels can only be written straight into the desktop's image while it is in
+// the format they are being decoded in.
+rdr::U8* CConn::getRawPixelsRW(const rfb::Rect& r, int* stride) {
+  if (!desktop->getPF().equal(cp.pf())) return 0;
+  return desktop->getRawPixelsRW(r, stride);
+}
+void CConn::releaseRawPixels(const rfb::Rect& r) {
+  desktop->releaseRawPixels(r);
+}
 void CConn::setCursor(int width, int height, const Point& hotspot,
                       void* data, void* mask) {
   desktop->setCursor(width, height, hotspot, data, mask);
 }
+void CConn::setCursorPos(const Point& pos) {
+  desktop->setCursorPos(pos);
+}
 
 
 // Menu stuff - menuSelect() is called when the user selects a menu option.
@@ -434,7 +509,7 @@ void CConn::menuSelect(long id, TXMenu* m) {
               cp.name(), serverHost, serverPort, cp.width, cp.height,
               pfStr, spfStr, encodingName(currentEncoding),
               encodingName(lastServerEncoding),
-              sock->inStream().kbitsPerSecond(),
+              kbitsPerSecond(),
               cp.majorVersion, cp.minorVersion,
               secTypeName(secType));
       info.setText(infoText);
@@ -448,8 +523,8 @@ void CConn::menuSelect(long id, TXMenu* m) {
     break;
   case ID_REFRESH:
     menu.unmap();
-    writer()->writeFramebufferUpdateRequest(Rect(0, 0, cp.width, cp.height),
-                                            false);
+    if (!requestedRect.is_empty())
+      writer()->writeFramebufferUpdateRequest(requestedRect, false);
     break;
   case ID_F8:
     menu.unmap();
@@ -558,6 +633,7 @@ void CConn::getOptions() {
   useLocalCursor.setParam(options.useLocalCursor.checked());
   if (cp.supportsLocalCursor != useLocalCursor) {
     cp.supportsLocalCursor = useLocalCursor;
+    cp.supportsCursorPos = useLocalCursor;
     encodingChange = true;
     if (desktop)
       desktop->resetLocalCursor();
@@ -569,10 +645,11 @@ void CConn::getOptions() {
 void CConn::recreateViewport()
 {
   TXViewport* oldViewport = viewport;
-  fprintf(stderr, "TED__CCon::recreateViewport --> new viewport of(%d, %d)\n", w_scaled, h_scaled);
-  viewport = new TXViewport(dpy, w_scaled, h_scaled);
+  viewport = new TXViewport(dpy, desktop->width(), desktop->height());
 
   desktop->setViewport(viewport);
+  viewport->setEventHandler(this);
+  viewportMapped = true;
   CharArray windowNameStr(windowName.getData());
   if (!windowNameStr.buf[0]) {
     windowNameStr.replaceBuf(new char[256]);
@@ -597,29 +674,32 @@ void CConn::recreateViewport()
     XUngrabKeyboard(dpy, CurrentTime);
   }
   if (oldViewport) delete oldViewport;
+  viewport->setCallback(this);
+  viewportChanged(viewport);
 }
 
 void CConn::reconfigureViewport()
 {
-  viewport->setMaxSize(cp.width, cp.height);
+  viewport->setMaxSize(desktop->width(), desktop->height());
   if (fullScreen) {
     fprintf(stderr, "TED__CCon::reconfigureViewport --> DisplayWidth(dpy,DefaultScreen(dpy) of(%d, %d)\n",
             DisplayWidth(dpy,DefaultScreen(dpy)), DisplayHeight(dpy,DefaultScreen(dpy)));
     viewport->resize(DisplayWidth(dpy,DefaultScreen(dpy)),
                      DisplayHeight(dpy,DefaultScreen(dpy)));
   } else {
-//    int w = cp.width;
-//    int h = cp.height;
-//    if (w + wmDecorationWidth >= DisplayWidth(dpy,DefaultScreen(dpy)))
-//      w = DisplayWidth(dpy,DefaultScreen(dpy)) - wmDecorationWidth;
-//    if (h + wmDecorationHeight >= DisplayHeight(dpy,DefaultScreen(dpy)))
-//      h = DisplayHeight(dpy,DefaultScreen(dpy)) - wmDecorationHeight;
-//
-//    int x = (DisplayWidth(dpy,DefaultScreen(dpy)) - w - wmDecorationWidth) / 2;
-//    int y = (DisplayHeight(dpy,DefaultScreen(dpy)) - h - wmDecorationHeight)/2;
+    // The desktop window is the size the desktop is scaled to, if scaling.
+    int w = desktop->width();
+    int h = desktop->height();
+    if (w + wmDecorationWidth >= DisplayWidth(dpy,DefaultScreen(dpy)))
+      w = DisplayWidth(dpy,DefaultScreen(dpy)) - wmDecorationWidth;
+    if (h + wmDecorationHeight >= DisplayHeight(dpy,DefaultScreen(dpy)))
+      h = DisplayHeight(dpy,DefaultScreen(dpy)) - wmDecorationHeight;
+
+    int x = (DisplayWidth(dpy,DefaultScreen(dpy)) - w - wmDecorationWidth) / 2;
+    int y = (DisplayHeight(dpy,DefaultScreen(dpy)) - h - wmDecorationHeight)/2;
 
     CharArray geometryStr(geometry.getData());
-    viewport->setGeometry(geometryStr.buf, 0, 0, w_scaled, h_scaled);
+    viewport->setGeometry(geometryStr.buf, x, y, w, h);
   }
 }
 
@@ -631,29 +711,28 @@ void CConn::reconfigureViewport()
 //   Above 1Mbps, switch to full colour mode
 void CConn::autoSelectFormatAndEncoding()
 {
-  int kbitsPerSecond = sock->inStream().kbitsPerSecond();
+  int kbits = kbitsPerSecond();
   unsigned int newEncoding = currentEncoding;
 
-  if (kbitsPerSecond > 16000 && sameMachine &&
-      sock->inStream().timeWaited() >= 10000) {
+  if (kbits > 16000 && sameMachine && timeWaited() >= 10000) {
     newEncoding = encodingRaw;
-  } else if (kbitsPerSecond > 3000) {
+  } else if (kbits > 3000) {
     newEncoding = encodingHextile;
-  } else if (kbitsPerSecond < 1500) {
+  } else if (kbits < 1500) {
     newEncoding = encodingZRLE;
   }
 
   if (newEncoding != currentEncoding) {
     vlog.info("Throughput %d kbit/s - changing to %s encoding",
-              kbitsPerSecond, encodingName(newEncoding));
+              kbits, encodingName(newEncoding));
     currentEncoding = newEncoding;
     encodingChange = true;
   }
 
-  if (kbitsPerSecond > 1000) {
+  if (kbits > 1000) {
     if (!fullColour) {
       vlog.info("Throughput %d kbit/s - changing to full colour",
-                kbitsPerSecond);
+                kbits);
       fullColour = true;
       formatChange = true;
     }
@@ -690,9 +769,78 @@ void CConn::requestNewUpdate()
     vlog.info("Using pixel format %s",str);
     cp.setPF(desktop->getPF());
     writer()->writeSetPixelFormat(cp.pf());
+
+    // Everything must be sent again in the new format
+    requestedRect.clear();
+    formatChange = false;
   }
   checkEncodings();
-  writer()->writeFramebufferUpdateRequest(Rect(0, 0, cp.width, cp.height),
-                                          !formatChange);
-  formatChange = false;
+  requestVisible();
+}
+
+// visibleRect() returns the part of the framebuffer to request updates for.
+// This is the part which can be seen, plus a margin around it so that a
+// little scrolling shows up to date pixels at once.  It is empty if none of
+// the desktop can be seen.
+
+Rect CConn::visibleRect()
+{
+  if (!viewportMapped || desktopObscured)
+    return Rect();
+  Rect r = desktop->visibleRect();
+  if (r.is_empty())
+    return r;
+  int margin = prefetchMargin;
+  r.tl.x -= margin;
+  r.tl.y -= margin;
+  r.br.x += margin;
+  r.br.y += margin;
+  return r.intersect(Rect(0, 0, cp.width, cp.height));
+}
+
+// requestVisible() asks for an update of the visible part of the framebuffer.
+// Any of it which was not being requested before may be out of date, so that
+// is asked for in full.  While none of it can be seen, no update is asked for
+// and updatesPaused is set, so that viewportChanged() knows to ask again.  If
+// an update request is already outstanding, only the parts which are new are
+// asked for, and the reply to that request asks for the rest next time.
+// Otherwise each extra request would keep another update in flight for good.
+
+void CConn::requestVisible(bool outstanding)
+{
+  Rect visible = visibleRect();
+  updatesPaused = visible.is_empty();
+  if (updatesPaused) return;
+
+  rfb::Region fresh(visible);
+  fresh.assign_subtract(rfb::Region(requestedRect));
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  fresh.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    writer()->writeFramebufferUpdateRequest(*i, false);
+  if (!outstanding && !fresh.equals(rfb::Region(visible)))
+    writer()->writeFramebufferUpdateRequest(visible, true);
+  requestedRect = visible;
+}
+
+// viewportChanged() is called when the part of the desktop which can be seen
+// may have changed, through scrolling, resizing, iconifying or being covered
+// up.  Parts which have come into view are asked for at once, rather than
+// waiting for the next update.  Until the first update has been asked for,
+// there is nothing to do.
+
+void CConn::viewportChanged(TXViewport* v)
+{
+  if (!desktop || (requestedRect.is_empty() && !updatesPaused))
+    return;
+  Rect visible = visibleRect();
+  if (visible.equals(requestedRect))
+    return;
+  if (!updatesPaused && !visible.is_empty() &&
+      rfb::Region(visible).subtract(rfb::Region(requestedRect)).is_empty()) {
+    // Only shrunk - the next request will be for the smaller area
+    return;
+  }
+  requestVisible(!updatesPaused);
 }
@@ -29,21 +29,22 @@
 #include <list>
 
 #include "TXWindow.h"
+#include "TXViewport.h"
 #include "AboutDialog.h"
 #include "InfoDialog.h"
 #include "TXMenu.h"
 #include "OptionsDialog.h"
 
 class TXWindow;
-class TXViewport;
 class DesktopWindow;
+class ThreadedInStream;
 namespace network { class Socket; }
 
 class CConn : public rfb::CConnection, public rfb::UserPasswdGetter,
               public TXDeleteWindowCallback,
               public rdr::FdInStreamBlockCallback,
               public TXMenuCallback , public OptionsDialogCallback,
-              public TXEventHandler
+              public TXEventHandler, public TXViewportCallback
 {
 public:
 
@@ -69,6 +70,9 @@ public:
 
   // TXEventHandler callback method
   virtual void handleEvent(TXWindow* w, XEvent* ev);
+
+  // TXViewportCallback method
+  virtual void viewportChanged(TXViewport* v);
   
   // CConnection callback methods
   rfb::CSecurity* getCSecurity(int secType);
@@ -83,11 +87,12 @@ public:
   void fillRect(const rfb::Rect& r, rfb::Pixel p);
   void imageRect(const rfb::Rect& r, void* p);
   void copyRect(const rfb::Rect& r, int sx, int sy);
+  rdr::U8* getRawPixelsRW(const rfb::Rect& r, int* stride);
+  void releaseRawPixels(const rfb::Rect& r);
   void setCursor(int width, int height, const rfb::Point& hotspot,
                  void* data, void* mask);
+  void setCursorPos(const rfb::Point& pos);
 
-    const static int w_scaled = 1024;
-    const static int h_scaled = 768;
 private:
 
   void recreateViewport();
@@ -97,6 +102,12 @@ private:
   void autoSelectFormatAndEncoding();
   void checkEncodings();
   void requestNewUpdate();
+  rfb::Rect visibleRect();
+  void requestVisible(bool outstanding=false);
+  void startTiming();
+  void stopTiming();
+  unsigned int kbitsPerSecond();
+  unsigned int timeWaited();
 
   Display* dpy;
   int argc;
@@ -104,6 +115,7 @@ private:
   char* serverHost;
   int serverPort;
   network::Socket* sock;
+  ThreadedInStream* threadedIn;
   rfb::PixelFormat serverPF;
   TXViewport* viewport;
   DesktopWindow* desktop;
@@ -115,6 +127,14 @@ private:
   bool autoSelect;
   bool shared;
   bool formatChange;
+
+  // requestedRect is the part of the framebuffer which updates are being
+  // requested for.  Updates stop while none of the desktop can be seen,
+  // either because the window is unmapped or because it is fully obscured.
+  rfb::Rect requestedRect;
+  bool updatesPaused;
+  bool viewportMapped;
+  bool desktopObscured;
   bool encodingChange;
   bool sameMachine;
   bool fullScreen;
@@ -62,14 +62,21 @@ using namespace rfb;
 
 static rfb::LogWriter vlog("DesktopWindow");
 
+static bool scalingEnabled()
+{
+  return scaledWidth > 0 && scaledHeight > 0;
+}
+
 DesktopWindow::DesktopWindow(Display* dpy, int w, int h,
                              const rfb::PixelFormat& serverPF,
                              CConn* cc_, TXWindow* parent)
-  : TXWindow(dpy, w_scaled, h_scaled, parent), cc(cc_), im(0),
+  : TXWindow(dpy, scalingEnabled() ? (int)scaledWidth : w,
+             scalingEnabled() ? (int)scaledHeight : h, parent),
+    cc(cc_), im(0),
     cursorVisible(false), cursorAvailable(false), currentSelectionTime(0),
     newSelection(0), gettingInitialSelectionTime(true),
     newServerCutText(false), serverCutText_(0),
-    setColourMapEntriesTimer(this), viewport(0),
+    setColourMapEntriesTimer(this), presentTimer(this), viewport(0),
     pointerEventTimer(this),
     lastButtonMask(0)
 {
@@ -80,10 +87,19 @@ DesktopWindow::DesktopWindow(Display* dpy, int w, int h,
                EnterWindowMask | LeaveWindowMask);
   createXCursors();
   XDefineCursor(dpy, win(), dotCursor);
-  fprintf(stderr, "TED__DesktopWindow::DesktopWindow --> new TXImage of(%d, %d)\n", w, h);
   im = new TXImage(dpy, w, h);
   if (!serverPF.trueColour)
     im->setPF(serverPF);
+  if (scalingEnabled()) {
+    CharArray filter(scaleFilter.getData());
+    CharArray method(scaleMethod.getData());
+    im->setScaleFilter(filter.buf);
+    im->setScaleMethod(method.buf);
+    im->setScaledSize(width(), height());
+    if (!im->scaling())
+      TXWindow::resize(w, h);
+  }
+  Timer::getTime(&lastPresentTime);
   XConvertSelection(dpy, sendPrimary ? XA_PRIMARY : xaCLIPBOARD, xaTIMESTAMP,
                     xaSELECTION_TIME, win(), CurrentTime);
   memset(downKeysym, 0, 256*4);
@@ -105,6 +121,18 @@ void DesktopWindow::setViewport(TXViewport* viewport_)
   viewport->setChild(this);
 }
 
+Rect DesktopWindow::visibleRect()
+{
+  if (!viewport) return im->getRect();
+  Rect r = viewport->visibleRect();
+  if (!im->scaling())
+    return r;
+  return Rect(r.tl.x * im->width() / width(),
+                   r.tl.y * im->height() / height(),
+                   (r.br.x * im->width() + width() - 1) / width(),
+                   (r.br.y * im->height() + height() - 1) / height());
+}
+
 // Cursor stuff
 
 void DesktopWindow::createXCursors()
@@ -204,11 +232,24 @@ void DesktopWindow::setCursor(int width, int height, const Point& hotspot,
   showLocalCursor();
 }
 
+void DesktopWindow::setCursorPos(const rfb::Point& pos)
+{
+  if (cursorAvailable && !pos.equals(cursorPos)) {
+    hideLocalCursor();
+    if (im->getRect().contains(pos)) {
+      cursorPos = pos;
+      showLocalCursor();
+    }
+    present();
+  }
+}
+
 void DesktopWindow::resetLocalCursor()
 {
   hideLocalCursor();
   XDefineCursor(dpy, win(), dotCursor);
   cursorAvailable = false;
+  present();
 }
 
 void DesktopWindow::hideLocalCursor()
@@ -217,7 +258,7 @@ void DesktopWindow::hideLocalCursor()
   if (cursorVisible) {
     cursorVisible = false;
     im->imageRect(cursorBackingRect, cursorBacking.data);
-    im->put(win(), gc, cursorBackingRect);
+    damage.assign_union(rfb::Region(cursorBackingRect));
   }
 }
 
@@ -239,7 +280,7 @@ void DesktopWindow::showLocalCursor()
     im->getImage(cursorBacking.data, cursorBackingRect);
 
     im->maskRect(cursorRect, cursor.data, cursor.mask.buf);
-    im->put(win(), gc, cursorBackingRect);
+    damage.assign_union(rfb::Region(cursorBackingRect));
   }
 }
 
@@ -279,9 +320,98 @@ void DesktopWindow::serverCutText(const char* str, int len)
 
 void DesktopWindow::framebufferUpdateEnd()
 {
+  present();
   XSync(dpy, False);
 }
 
+// present() draws the damaged parts of the image in the window, but no more
+// often than presentInterval().  Changes which arrive sooner are left to
+// accumulate, and are drawn together when presentTimer goes off.  Nor is
+// anything drawn while the X server may still be reading the shared memory
+// image for the last present, since writing to the image would then have to
+// wait for it - presentTimer tries again shortly.
+
+#define SHM_RETRY_MS 2
+
+void DesktopWindow::present()
+{
+  if (damage.is_empty() && !im->scalePending()) return;
+  if (presentTimer.isStarted()) return;
+
+  timeval now;
+  Timer::getTime(&now);
+  int elapsed = ((now.tv_sec - lastPresentTime.tv_sec) * 1000 +
+                 (now.tv_usec - lastPresentTime.tv_usec) / 1000);
+  int interval = presentInterval();
+  if (elapsed >= 0 && elapsed < interval) {
+    presentTimer.start(interval - elapsed);
+    return;
+  }
+  if (im->shmPutPending()) {
+    presentTimer.start(SHM_RETRY_MS);
+    return;
+  }
+
+  putDamage();
+  if (im->scaling())
+    im->flushScaled(win(), gc);
+  lastPresentTime = now;
+}
+
+// presentInterval() is the shortest time in milliseconds between presents.
+// There is no point drawing more often than the display refreshes, and
+// scaling is costly enough to be worth doing less often still.
+
+int DesktopWindow::presentInterval()
+{
+  int interval = frameRate > 0 ? 1000 / frameRate : 0;
+  if (im->scaling() && scaleInterval > interval)
+    interval = scaleInterval;
+  return interval;
+}
+
+// putDamage() puts the damaged region into the window in a few rectangles.
+// An update of many small rectangles would otherwise take one put each.
+// Rectangles are merged where the pixels this adds cost less than a put
+// does, and if that still leaves more than MAX_PUTS, the bounding rectangle
+// is put instead.
+
+#define MAX_PUTS 16
+#define PUT_COST_PIXELS (64*64)
+
+void DesktopWindow::putDamage()
+{
+  std::vector<Rect> rects;
+  std::vector<Rect> puts;
+  std::vector<Rect>::iterator i, j;
+  damage.assign_intersect(rfb::Region(im->getRect()));
+  damage.get_rects(&rects);
+  damage.clear();
+
+  for (i = rects.begin(); i != rects.end(); i++) {
+    for (j = puts.begin(); j != puts.end(); j++) {
+      Rect merged = j->union_boundary(*i);
+      if (merged.area() - j->area() - i->area() <= PUT_COST_PIXELS) {
+        *j = merged;
+        break;
+      }
+    }
+    if (j == puts.end())
+      puts.push_back(*i);
+  }
+
+  if (puts.size() > MAX_PUTS) {
+    Rect bounds = puts[0];
+    for (j = puts.begin(); j != puts.end(); j++)
+      bounds = bounds.union_boundary(*j);
+    puts.clear();
+    puts.push_back(bounds);
+  }
+
+  for (j = puts.begin(); j != puts.end(); j++)
+    im->put(win(), gc, *j);
+}
+
 
 // invertRect() flips all the bits in every pixel in the given rectangle
 
@@ -298,11 +428,7 @@ void DesktopWindow::invertRect(const Rect& r)
       }
     }
   }
-  fprintf(stderr, "TED__DesktopWindow::invertRect --> im->put rect(%d, %d, %d, %d)\n",
-          r.tl.x, r.tl.y,
-          r.width(),
-          r.height());
-  im->put(win(), gc, r);
+  damage.assign_union(rfb::Region(r));
 }
 
 
@@ -311,9 +437,9 @@ void DesktopWindow::invertRect(const Rect& r)
 void DesktopWindow::resize(int w, int h)
 {
   hideLocalCursor();
-  fprintf(stderr, "TED__DesktopWindow::resize --> set fixed size --- TXWindow::resize(%d, %d)\n", w_scaled,h_scaled);
-  TXWindow::resize(w_scaled, h_scaled);
-  fprintf(stderr, "TED__DesktopWindow::resize --> im::resize(%d, %d)\n", w,h);
+  // A scaled window keeps its size - only the scale factors change.
+  if (!im->scaling())
+    TXWindow::resize(w, h);
   im->resize(w, h);
 }
 
@@ -322,7 +448,10 @@ bool DesktopWindow::handleTimeout(rfb::Timer* timer)
 {
   if (timer == &setColourMapEntriesTimer) {
     im->updateColourMap();
-    im->put(win(), gc, im->getRect());
+    damage.reset(im->getRect());
+    present();
+  } else if (timer == &presentTimer) {
+    present();
   } else if (timer == &pointerEventTimer) {
     if (!viewOnly) {
       cc->writer()->pointerEvent(lastPointerPos, lastButtonMask);
@@ -345,50 +474,19 @@ void DesktopWindow::handlePointerEvent(const Point& pos, int buttonMask)
     lastButtonMask = buttonMask;
   }
   // - If local cursor rendering is enabled then use it
-  if (cursorAvailable) {
-    // - Render the cursor!
-    if (!pos.equals(cursorPos)) {
-      hideLocalCursor();
-      if (im->getRect().contains(pos)) {
-        cursorPos = pos;
-        showLocalCursor();
-      }
-    }
-  }
+  setCursorPos(pos);
 }
 
 
 // handleXEvent() handles the various X events on the window
 void DesktopWindow::handleEvent(TXWindow* w, XEvent* ev)
 {
-    double w_scale_rate, h_scaled_rate;
-//    w_scale_rate = (double)(w_scaled)/width();
-//    h_scaled_rate = (double)(h_scaled)/height();
-
-    w_scale_rate = (double)1920/(w_scaled);
-    h_scaled_rate = (double)1080/(h_scaled);
-    int x_start = (int)(ev->xexpose.x * w_scale_rate);
-    int y_start = (int)(ev->xexpose.y *h_scaled_rate);
-    int x_end = (int)((ev->xexpose.x + ev->xexpose.width) * w_scale_rate);
-    int y_end = (int)((ev->xexpose.y + ev->xexpose.height) * h_scaled_rate);
-
-   // fprintf(stderr, "TED__DesktopWindow::handleEvent --> w(%d, %d)\n", width(), height());
   switch (ev->type) {
   case GraphicsExpose:
   case Expose:
-    fprintf(stderr, "TED__DesktopWindow::handleEvent --> case Expose rect(%d, %d, %d, %d)\n",
-            ev->xexpose.x, ev->xexpose.y,
-            ev->xexpose.x + ev->xexpose.width,
-            ev->xexpose.y + ev->xexpose.height);
-
-//
-//    im->put(win(), gc, Rect((int)(ev->xexpose.x * w_scale_rate),
-//                            (int)(ev->xexpose.y *h_scaled_rate),
-//                            (int)((ev->xexpose.x + ev->xexpose.width) * w_scale_rate) ,
-//                            ev->xexpose.y + ev->xexpose.height));
-//    fprintf(stderr, "TED__DesktopWindow::handleEvent --> im->put(%d, %d: %d, %d)\n",
-//                    x_start, y_start, x_end, y_end);
-    im->put(win(), gc, Rect(x_start, y_start, x_end, y_end));
+    im->putScaled(win(), gc, Rect(ev->xexpose.x, ev->xexpose.y,
+                                  ev->xexpose.x + ev->xexpose.width,
+                                  ev->xexpose.y + ev->xexpose.height));
     break;
 
 //  case MotionNotify:
@@ -43,6 +43,10 @@ public:
 
   void setViewport(TXViewport* viewport);
 
+  // visibleRect() returns the part of the framebuffer which can be seen in the
+  // viewport
+  rfb::Rect visibleRect();
+
   // getPF() and setPF() get and set the TXImage's pixel format
   const rfb::PixelFormat& getPF() { return im->getPF(); }
   void setPF(const rfb::PixelFormat& pf) { im->setPF(pf); }
@@ -51,6 +55,10 @@ public:
   void setCursor(int width, int height, const rfb::Point& hotspot,
                  void* data, void* mask);
 
+  // setCursorPos() moves the local cursor, when the server says the pointer
+  // has been moved by someone else
+  void setCursorPos(const rfb::Point& pos);
+
   // resetLocalCursor() stops the rendering of the local cursor
   void resetLocalCursor();
 
@@ -59,24 +67,19 @@ public:
   void serverCutText(const char* str, int len);
   void framebufferUpdateEnd();
 
+  // The decoded rectangles are only added to the damaged region here.  They
+  // are drawn together by present() at the end of the update.
+
   void fillRect(const rfb::Rect& r, rfb::Pixel pix) {
     if (r.overlaps(cursorBackingRect)) hideLocalCursor();
     im->fillRect(r, pix);
-    fprintf(stderr, "TED__DesktopWindow::fillRect --> im->put rect(%d, %d, %d, %d)\n",
-            r.tl.x, r.tl.y,
-            r.width(),
-            r.height());
-    im->put(win(), gc, r);
+    damage.assign_union(rfb::Region(r));
     showLocalCursor();
   }
   void imageRect(const rfb::Rect& r, void* pixels) {
     if (r.overlaps(cursorBackingRect)) hideLocalCursor();
     im->imageRect(r, pixels);
-    fprintf(stderr, "TED__DesktopWindow::imageRect --> im->put rect(%d, %d, %d, %d)\n",
-            r.tl.x, r.tl.y,
-            r.width(),
-            r.height());
-    im->put(win(), gc, r);
+    damage.assign_union(rfb::Region(r));
     showLocalCursor();
   }
   void copyRect(const rfb::Rect& r, int srcX, int srcY) {
@@ -84,13 +87,29 @@ public:
         cursorBackingRect.overlaps(rfb::Rect(srcX, srcY,
                                              srcX+r.width(), srcY+r.height())))
       hideLocalCursor();
-    if (im->usingShm())
-      XSync(dpy, False);
     im->copyRect(r, rfb::Point(r.tl.x-srcX, r.tl.y-srcY));
-    XCopyArea(dpy, win(), win(), gc, srcX, srcY,
-              r.width(), r.height(), r.tl.x, r.tl.y);
+    // The window can only be copied from if the source has been drawn.
+    if (im->scaling() ||
+        !damage.intersect(rfb::Region(rfb::Rect(srcX, srcY, srcX+r.width(),
+                                               srcY+r.height()))).is_empty())
+      damage.assign_union(rfb::Region(r));
+    else
+      XCopyArea(dpy, win(), win(), gc, srcX, srcY,
+                r.width(), r.height(), r.tl.x, r.tl.y);
     showLocalCursor();
   }
+
+  // getRawPixelsRW() and releaseRawPixels() let a decoder write pixels
+  // straight into the image, instead of passing them to imageRect().
+  rdr::U8* getRawPixelsRW(const rfb::Rect& r, int* stride) {
+    if (r.overlaps(cursorBackingRect)) hideLocalCursor();
+    return im->getPixelsRW(r, stride);
+  }
+  void releaseRawPixels(const rfb::Rect& r) {
+    damage.assign_union(rfb::Region(r));
+    showLocalCursor();
+  }
+
   void invertRect(const rfb::Rect& r);
 
   // TXWindow methods
@@ -101,15 +120,15 @@ public:
                                int nitems, void* data);
   virtual void handleEvent(TXWindow* w, XEvent* ev);
 
-    const static int w_scaled = 1024;
-    const static int h_scaled = 768;
-
 private:
 
   void createXCursors();
   void hideLocalCursor();
   void showLocalCursor();
   bool handleTimeout(rfb::Timer* timer);
+  void present();
+  void putDamage();
+  int presentInterval();
   void handlePointerEvent(const rfb::Point& pos, int buttonMask);
 
   CConn* cc;
@@ -131,6 +150,13 @@ private:
   char* serverCutText_;
 
   rfb::Timer setColourMapEntriesTimer;
+
+  // damage is the part of the image which has changed but has not yet been
+  // drawn in the window.  It is drawn once per update, but no more often than
+  // presentInterval(), using presentTimer to draw any which is left over.
+  rfb::Region damage;
+  rfb::Timer presentTimer;
+  timeval lastPresentTime;
   TXViewport* viewport;
   rfb::Timer pointerEventTimer;
   rfb::Point lastPointerPos;
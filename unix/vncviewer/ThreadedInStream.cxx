@@ -0,0 +1,261 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <rdr/Exception.h>
+#include "ThreadedInStream.h"
+
+using namespace rdr;
+
+enum { DEFAULT_BUF_SIZE = 16384,
+       DEFAULT_RING_SIZE = 1024 * 1024 };
+
+// The reader thread wakes up this often to see whether it should stop.
+#define READ_POLL_MS 200
+
+#define barrier() __sync_synchronize()
+
+static void notify(int fd)
+{
+  char c = 0;
+  while (write(fd, &c, 1) < 0 && errno == EINTR) ;
+}
+
+static void drain(int fd)
+{
+  char buf[64];
+  while (read(fd, buf, sizeof(buf)) > 0) ;
+}
+
+static void makePipe(int fds[2], bool blockingRead)
+{
+  if (pipe(fds) < 0)
+    throw SystemException("pipe", errno);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  if (!blockingRead)
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+}
+
+ThreadedInStream::ThreadedInStream(FdInStream* in_,
+                                   FdInStreamBlockCallback* cb,
+                                   int ringSize_)
+  : in(in_), blockCallback(cb), ringSize(1), head(0), tail(0),
+    readerWaiting(false), consumerWaiting(false), finished(false),
+    stopping(false), endOfStream(false), timing(false), kbits(0), waited(0),
+    bufSize(DEFAULT_BUF_SIZE), offset(0)
+{
+  if (!ringSize_) ringSize_ = DEFAULT_RING_SIZE;
+  while ((int)ringSize < ringSize_) ringSize <<= 1;
+  error[0] = 0;
+
+  makePipe(dataPipe, false);
+  makePipe(spacePipe, true);
+
+  ring = new U8[ringSize];
+  ptr = end = start = new U8[bufSize];
+
+  in->setBlockCallback(0);
+  in->setTimeout(READ_POLL_MS);
+
+  int err = pthread_create(&thread, 0, readerThread, this);
+  if (err) throw SystemException("pthread_create", err);
+}
+
+ThreadedInStream::~ThreadedInStream()
+{
+  stopping = true;
+  barrier();
+  notify(spacePipe[1]);
+  pthread_join(thread, 0);
+
+  close(dataPipe[0]);
+  close(dataPipe[1]);
+  close(spacePipe[0]);
+  close(spacePipe[1]);
+  delete [] ring;
+  delete [] start;
+}
+
+int ThreadedInStream::pos()
+{
+  return offset + ptr - start;
+}
+
+int ThreadedInStream::overrun(int itemSize, int nItems, bool wait)
+{
+  if (itemSize > bufSize)
+    throw Exception("ThreadedInStream overrun: max itemSize exceeded");
+
+  if (end - ptr != 0)
+    memmove(start, ptr, end - ptr);
+
+  offset += ptr - start;
+  end -= ptr - start;
+  ptr = start;
+
+  while (end < start + itemSize) {
+    int n = takeFromRing((U8*)end, start + bufSize - end);
+    if (n) {
+      end += n;
+      continue;
+    }
+
+    // The reader thread sets finished only after putting the last of the
+    // data in the ring, so check the ring again once finished is seen.
+    if (finished) {
+      barrier();
+      n = takeFromRing((U8*)end, start + bufSize - end);
+      if (n) {
+        end += n;
+        continue;
+      }
+      if (endOfStream) throw EndOfStream();
+      throw Exception(error);
+    }
+
+    if (!wait) return 0;
+    waitForData();
+  }
+
+  if (itemSize * nItems > end - ptr)
+    nItems = (end - ptr) / itemSize;
+
+  return nItems;
+}
+
+// takeFromRing() copies up to len bytes out of the ring, and wakes the reader
+// thread if it is waiting for space.
+
+int ThreadedInStream::takeFromRing(U8* buf, int len)
+{
+  unsigned int available = head - tail;
+  barrier();
+  if (available == 0) return 0;
+
+  unsigned int n = available < (unsigned int)len ? available : len;
+  unsigned int at = tail & (ringSize - 1);
+  unsigned int first = ringSize - at < n ? ringSize - at : n;
+  memcpy(buf, ring + at, first);
+  memcpy(buf + first, ring, n - first);
+
+  barrier();
+  tail += n;
+  barrier();
+  if (readerWaiting)
+    notify(spacePipe[1]);
+  return n;
+}
+
+// waitForData() waits until the reader thread has put something in the ring
+// or finished.  Setting consumerWaiting before checking the ring again means
+// that either we see the new data, or the reader thread sees the flag and
+// writes to the pipe.
+
+void ThreadedInStream::waitForData()
+{
+  consumerWaiting = true;
+  barrier();
+  if (head == tail && !finished) {
+    if (blockCallback) {
+      blockCallback->blockCallback();
+    } else {
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(dataPipe[0], &fds);
+      if (select(dataPipe[0]+1, &fds, 0, 0, 0) < 0 && errno != EINTR)
+        throw SystemException("select", errno);
+    }
+  }
+  consumerWaiting = false;
+  drain(dataPipe[0]);
+}
+
+void* ThreadedInStream::readerThread(void* stream)
+{
+  ((ThreadedInStream*)stream)->readLoop();
+  return 0;
+}
+
+void ThreadedInStream::readLoop()
+{
+  try {
+    while (!stopping) {
+      if (head - tail == ringSize) {
+        waitForSpace();
+        continue;
+      }
+
+      bool timed = timing;
+      if (timed) in->startTiming();
+      try {
+        in->check(1);
+      } catch (TimedOut&) {
+        if (timed) in->stopTiming();
+        continue;
+      }
+      if (timed) {
+        in->stopTiming();
+        kbits = in->kbitsPerSecond();
+        waited = in->timeWaited();
+      }
+
+      unsigned int space = ringSize - (head - tail);
+      unsigned int n = in->getend() - in->getptr();
+      if (n > space) n = space;
+      unsigned int at = head & (ringSize - 1);
+      unsigned int first = ringSize - at < n ? ringSize - at : n;
+      memcpy(ring + at, in->getptr(), first);
+      memcpy(ring, in->getptr() + first, n - first);
+      in->setptr(in->getptr() + n);
+
+      barrier();
+      head += n;
+      barrier();
+      if (consumerWaiting)
+        notify(dataPipe[1]);
+    }
+  } catch (EndOfStream&) {
+    endOfStream = true;
+  } catch (Exception& e) {
+    strncpy(error, e.str(), sizeof(error) - 1);
+    error[sizeof(error) - 1] = 0;
+  }
+
+  barrier();
+  finished = true;
+  barrier();
+  notify(dataPipe[1]);
+}
+
+// waitForSpace() is the reader thread's side of waitForData().
+
+void ThreadedInStream::waitForSpace()
+{
+  readerWaiting = true;
+  barrier();
+  if (head - tail == ringSize && !stopping) {
+    char buf[64];
+    while (read(spacePipe[0], buf, sizeof(buf)) < 0 && errno == EINTR) ;
+  }
+  readerWaiting = false;
+}
@@ -0,0 +1,99 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// ThreadedInStream is an InStream whose data is read from an FdInStream by a
+// separate thread.  The reader thread keeps draining the socket into a ring
+// buffer while the main thread is busy decoding and drawing, so the network
+// is not left idle whenever we blit or scale.
+//
+// The ring buffer has a single producer and a single consumer, so it needs no
+// locks - each side only ever advances its own index, with memory barriers
+// either side.  When one side has to wait for the other it says so with a
+// flag, and the other side wakes it by writing a byte to a pipe.  The main
+// thread can therefore wait for data and X events together by selecting on
+// getNotifyFd() and the X connection.
+//
+
+#ifndef __THREADEDINSTREAM_H__
+#define __THREADEDINSTREAM_H__
+
+#include <pthread.h>
+#include <rdr/FdInStream.h>
+
+class ThreadedInStream : public rdr::InStream {
+public:
+
+  // The FdInStream must not be used by anything else once it has been given
+  // to a ThreadedInStream.  If a block callback is given, it is called
+  // (repeatedly) instead of blocking when there is no data.
+  ThreadedInStream(rdr::FdInStream* in, rdr::FdInStreamBlockCallback* cb=0,
+                   int ringSize=0);
+  virtual ~ThreadedInStream();
+
+  // getNotifyFd() returns a file descriptor which becomes readable when data
+  // or the end of the stream arrives while the main thread is waiting.
+  int getNotifyFd() { return dataPipe[0]; }
+
+  int pos();
+
+  // Timing is done by the reader thread, on the reads it makes while timing
+  // is turned on.  The results lag slightly behind the data being decoded.
+  void startTiming() { timing = true; }
+  void stopTiming() { timing = false; }
+  unsigned int kbitsPerSecond() { return kbits; }
+  unsigned int timeWaited() { return waited; }
+
+protected:
+  int overrun(int itemSize, int nItems, bool wait);
+
+private:
+  static void* readerThread(void* stream);
+  void readLoop();
+  void waitForSpace();
+  void waitForData();
+  int takeFromRing(rdr::U8* buf, int len);
+
+  rdr::FdInStream* in;
+  rdr::FdInStreamBlockCallback* blockCallback;
+  pthread_t thread;
+  int dataPipe[2];
+  int spacePipe[2];
+
+  // head and tail count all the bytes ever put into and taken out of the
+  // ring, which is a power of two in size so that they can wrap safely.
+  rdr::U8* ring;
+  unsigned int ringSize;
+  volatile unsigned int head;
+  volatile unsigned int tail;
+  volatile bool readerWaiting;
+  volatile bool consumerWaiting;
+  volatile bool finished;
+  volatile bool stopping;
+  bool endOfStream;
+  char error[256];
+
+  volatile bool timing;
+  volatile unsigned int kbits;
+  volatile unsigned int waited;
+
+  int bufSize;
+  int offset;
+  rdr::U8* start;
+};
+
+#endif
@@ -30,6 +30,16 @@ extern rfb::BoolParameter autoSelect;
 extern rfb::BoolParameter fullColour;
 extern rfb::IntParameter lowColourLevel;
 extern rfb::StringParameter preferredEncoding;
+extern rfb::IntParameter compressLevel;
+extern rfb::BoolParameter readerThread;
+extern rfb::IntParameter scaledWidth;
+extern rfb::IntParameter scaledHeight;
+extern rfb::StringParameter scaleFilter;
+extern rfb::StringParameter scaleMethod;
+extern rfb::IntParameter scaleInterval;
+extern rfb::IntParameter frameRate;
+extern rfb::BoolParameter serverScaling;
+extern rfb::IntParameter prefetchMargin;
 extern rfb::BoolParameter viewOnly;
 extern rfb::BoolParameter shared;
 extern rfb::BoolParameter acceptClipboard;
@@ -72,6 +72,38 @@ IntParameter lowColourLevel("LowColourLevel",
 StringParameter preferredEncoding("PreferredEncoding",
                                   "Preferred encoding to use (ZRLE, hextile or"
                                   " raw) - implies AutoSelect=0", "");
+IntParameter compressLevel("CompressLevel",
+                           "Zlib compression level to ask the server for, "
+                           "from 0 to 9 (-1 leaves it to the server)", -1);
+BoolParameter readerThread("ReaderThread",
+                           "Read from the network on a separate thread, so "
+                           "that reading carries on while updates are drawn",
+                           true);
+IntParameter scaledWidth("ScaledWidth",
+                         "Width to scale the desktop to (0 = don't scale)",
+                         1024);
+IntParameter scaledHeight("ScaledHeight",
+                          "Height to scale the desktop to (0 = don't scale)",
+                          768);
+StringParameter scaleFilter("ScaleFilter",
+                            "RENDER filter used to scale the desktop - "
+                            "nearest, bilinear, fast, good or best", "best");
+StringParameter scaleMethod("ScaleMethod",
+                            "How to scale the desktop - render, cpu, or auto "
+                            "to use whichever is quicker", "auto");
+IntParameter scaleInterval("ScaleInterval",
+                           "Minimum time in milliseconds between drawing "
+                           "scaled updates", 30);
+IntParameter prefetchMargin("PrefetchMargin",
+                            "Width in pixels of the margin around the visible "
+                            "part of the desktop which is also kept up to "
+                            "date", 64);
+IntParameter frameRate("FrameRate",
+                       "Most times per second to draw updates, which need be "
+                       "no more than the display's refresh rate", 60);
+BoolParameter serverScaling("ServerScaling",
+                            "Ask the server to scale the desktop down before "
+                            "sending it, to save bandwidth", true);
 BoolParameter fullScreen("FullScreen", "Full screen mode", false);
 BoolParameter viewOnly("ViewOnly",
                        "Don't send any mouse or keyboard events to the server",
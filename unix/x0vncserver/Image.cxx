@@ -55,7 +55,7 @@ static int ShmCreationXErrorHandler(Display *dpy, XErrorEvent *error)
 }
 
 Image::Image(Display* d, int width, int height)
-  : xim(0), dpy(d), shminfo(0), usingShm(false)
+  : xim(0), dpy(d), shminfo(0), usingShm(false), pixmap(0), gc(0)
 {
   if (createShmImage(width, height)) return;
 
@@ -73,8 +73,14 @@ Image::Image(Display* d, int width, int height)
 Image::~Image()
 {
   fprintf(stderr,"~Image called - usingShm %d\n",usingShm);
+  if (pixmap) {
+    XFreeGC(dpy, gc);
+    XFreePixmap(dpy, pixmap);
+  }
   if (usingShm) {
     usingShm = false;
+    XShmDetach(dpy, shminfo);
+    XSync(dpy, False);
     shmdt(shminfo->shmaddr);
     shmctl(shminfo->shmid, IPC_RMID, 0);
     imageCleanup.images.remove(this);
@@ -84,16 +90,43 @@ Image::~Image()
   if (xim) XDestroyImage(xim);
 }
 
-void Image::get(Window w)
+void Image::get(Window w, int x, int y)
 {
   if (usingShm) {
-    XShmGetImage(dpy, w, xim, 0, 0, AllPlanes);
+    XShmGetImage(dpy, w, xim, x, y, AllPlanes);
   } else {
-    XGetSubImage(dpy, w, 0, 0, xim->width, xim->height,
+    XGetSubImage(dpy, w, x, y, xim->width, xim->height,
                  AllPlanes, ZPixmap, xim, 0, 0);
   }
 }
 
+void Image::getRect(Window w, int x, int y, int width, int height)
+{
+  XGetSubImage(dpy, w, x, y, width, height, AllPlanes, ZPixmap, xim, x, y);
+}
+
+// startGet() copies the window into the shared memory pixmap.  CopyArea has
+// no reply, so we only need to flush the request.  Because the GC has
+// graphics exposures enabled the X server follows the copy with a NoExpose
+// event (or GraphicsExpose events if part of the source was unavailable),
+// which tells us the image data is complete.
+
+void Image::startGet(Window w)
+{
+  XCopyArea(dpy, w, pixmap, gc, 0, 0, xim->width, xim->height, 0, 0);
+  XFlush(dpy);
+}
+
+bool Image::isGetDone(const XEvent* ev)
+{
+  if (ev->type == NoExpose)
+    return ev->xnoexpose.drawable == pixmap;
+  if (ev->type == GraphicsExpose)
+    return (ev->xgraphicsexpose.drawable == pixmap &&
+            ev->xgraphicsexpose.count == 0);
+  return false;
+}
+
 bool Image::createShmImage(int width, int height)
 {
   if (XShmQueryExtension(dpy)) {
@@ -124,6 +157,7 @@ bool Image::createShmImage(int width, int height)
             fprintf(stderr,"Using shared memory XImage\n");
             usingShm = true;
             imageCleanup.images.push_back(this);
+            createShmPixmap();
             return true;
           }
 
@@ -148,3 +182,22 @@ bool Image::createShmImage(int width, int height)
 
   return false;
 }
+
+void Image::createShmPixmap()
+{
+  int major, minor;
+  Bool sharedPixmaps;
+
+  if (!XShmQueryVersion(dpy, &major, &minor, &sharedPixmaps) ||
+      !sharedPixmaps || XShmPixmapFormat(dpy) != ZPixmap)
+    return;
+
+  pixmap = XShmCreatePixmap(dpy, DefaultRootWindow(dpy), shminfo->shmaddr,
+                            shminfo, xim->width, xim->height, xim->depth);
+
+  XGCValues gcv;
+  gcv.subwindow_mode = IncludeInferiors;
+  gcv.graphics_exposures = True;
+  gc = XCreateGC(dpy, pixmap, GCSubwindowMode | GCGraphicsExposures, &gcv);
+  fprintf(stderr,"Using shared memory pixmap\n");
+}
@@ -33,17 +33,36 @@ public:
   Image(Display* dpy, int width, int height);
   ~Image();
 
-  void get(Window w);
+  // get() fetches the contents of the given window into the whole image.  x
+  // and y give the position within the window of the image's top-left corner,
+  // so a narrow image can be used to fetch a single scanline.
+  void get(Window w, int x = 0, int y = 0);
+
+  // getRect() updates just the given rectangle of the image from the same
+  // position in the window, leaving the rest of the image untouched.
+  void getRect(Window w, int x, int y, int width, int height);
+
+  // startGet() begins fetching the contents of the given window into the
+  // whole image, without waiting for the X server to do it.  This is only
+  // possible when the image is backed by a shared memory pixmap, as indicated
+  // by canGetAsync().  The X server then sends an event on the image's display
+  // connection when it has finished, for which isGetDone() returns true.
+  bool canGetAsync() { return pixmap != 0; }
+  void startGet(Window w);
+  bool isGetDone(const XEvent* ev);
 
   XImage* xim;
 
 private:
 
   bool createShmImage(int width, int height);
+  void createShmPixmap();
 
   Display* dpy;
   XShmSegmentInfo* shminfo;
   bool usingShm;
+  Pixmap pixmap;
+  GC gc;
 };
 
 #endif
@@ -0,0 +1,121 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// PollingManager.cxx
+//
+
+#include <string.h>
+#include <rfb/LogWriter.h>
+#include <rfb/util.h>
+#include "PollingManager.h"
+
+using namespace rfb;
+
+static LogWriter vlog("PollingManager");
+
+// The order in which scanlines within a tile are sampled.  Successive polls
+// are spread out over the height of the tile so that a change anywhere in it
+// tends to be noticed within a few polls rather than only once per cycle.
+
+const int PollingManager::pollingOrder[TILE_SIZE] = {
+   0, 16,  8, 24,  4, 20, 12, 28,
+   2, 18, 10, 26,  6, 22, 14, 30,
+   1, 17,  9, 25,  5, 21, 13, 29,
+   3, 19, 11, 27,  7, 23, 15, 31
+};
+
+PollingManager::PollingManager(Display* dpy_, Image* image_,
+                               VNCServer* server_)
+  : dpy(dpy_), root(DefaultRootWindow(dpy_)), image(image_), rowImage(0),
+    server(server_), pollingStep(0)
+{
+  bytesPerPixel = image->xim->bits_per_pixel / 8;
+  tilesX = (image->xim->width + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (image->xim->height + TILE_SIZE - 1) / TILE_SIZE;
+  changedTiles = new bool[tilesX];
+  rowImage = new Image(dpy, image->xim->width, 1);
+  vlog.info("polling %dx%d tiles of %d pixels", tilesX, tilesY, TILE_SIZE);
+}
+
+PollingManager::~PollingManager()
+{
+  delete rowImage;
+  delete [] changedTiles;
+}
+
+int PollingManager::poll()
+{
+  int offset = pollingOrder[pollingStep];
+  pollingStep = (pollingStep + 1) % TILE_SIZE;
+
+  int changed = 0;
+  for (int tileY = 0; tileY < tilesY; tileY++) {
+    int y = tileY * TILE_SIZE + offset;
+    if (y >= image->xim->height)
+      continue;
+    changed += checkTileRow(tileY, y);
+  }
+  return changed;
+}
+
+// checkTileRow() fetches scanline y, which lies in the given row of tiles, and
+// compares it tile by tile with the image.  Runs of adjacent changed tiles are
+// then fetched with a single request each.
+
+int PollingManager::checkTileRow(int tileY, int y)
+{
+  rowImage->get(root, 0, y);
+
+  int width = image->xim->width;
+  char* newLine = rowImage->xim->data;
+  char* oldLine = image->xim->data + y * image->xim->bytes_per_line;
+  int tileBytes = TILE_SIZE * bytesPerPixel;
+
+  int changed = 0;
+  for (int tileX = 0; tileX < tilesX; tileX++) {
+    int len = tileBytes;
+    if (tileX == tilesX - 1)
+      len = (width - tileX * TILE_SIZE) * bytesPerPixel;
+    changedTiles[tileX] = (memcmp(newLine + tileX * tileBytes,
+                                  oldLine + tileX * tileBytes, len) != 0);
+    if (changedTiles[tileX])
+      changed++;
+  }
+  if (!changed)
+    return 0;
+
+  int top = tileY * TILE_SIZE;
+  int bottom = __rfbmin(top + TILE_SIZE, image->xim->height);
+
+  int tileX = 0;
+  while (tileX < tilesX) {
+    if (!changedTiles[tileX]) {
+      tileX++;
+      continue;
+    }
+    int start = tileX;
+    while (tileX < tilesX && changedTiles[tileX])
+      tileX++;
+
+    Rect r(start * TILE_SIZE, top,
+           __rfbmin(tileX * TILE_SIZE, width), bottom);
+    image->getRect(root, r.tl.x, r.tl.y, r.width(), r.height());
+    server->add_changed(r);
+  }
+  return changed;
+}
@@ -0,0 +1,75 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// PollingManager.h
+//
+// PollingManager finds out which parts of the screen have changed without
+// copying the whole of it on every poll.  The screen is divided into tiles of
+// TILE_SIZE by TILE_SIZE pixels.  Each call to poll() fetches just one
+// scanline from every row of tiles, choosing a different scanline each time so
+// that every line is visited over TILE_SIZE polls.  Only those tiles whose
+// sampled scanline differs from our copy are then fetched in full.
+//
+
+#ifndef __POLLINGMANAGER_H__
+#define __POLLINGMANAGER_H__
+
+#include <X11/Xlib.h>
+#include <rfb/VNCServer.h>
+#include "Image.h"
+
+class PollingManager {
+
+public:
+
+  PollingManager(Display* dpy, Image* image, rfb::VNCServer* server);
+  ~PollingManager();
+
+  // poll() samples the screen as described above, updates the changed tiles
+  // of the image and passes them to the server with add_changed().  It
+  // returns the number of changed tiles found.
+  int poll();
+
+  // setImage() replaces the image which the screen is compared against, for
+  // use when the caller has fetched a newer copy of the whole screen.
+  void setImage(Image* im) { image = im; }
+
+  int numTiles() { return tilesX * tilesY; }
+
+  enum { TILE_SIZE = 32 };
+
+private:
+
+  int checkTileRow(int tileY, int y);
+
+  Display* dpy;
+  Window root;
+  Image* image;
+  Image* rowImage;
+  rfb::VNCServer* server;
+
+  int bytesPerPixel;
+  int tilesX;
+  int tilesY;
+  int pollingStep;
+  bool* changedTiles;
+
+  static const int pollingOrder[TILE_SIZE];
+};
+
+#endif
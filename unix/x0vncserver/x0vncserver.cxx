@@ -31,6 +31,7 @@
 
 #include "QueryConnectDialog.h"
 #include "Image.h"
+#include "PollingManager.h"
 #include <signal.h>
 #include <X11/X.h>
 #include <X11/Xlib.h>
@@ -52,6 +53,14 @@ IntParameter queryConnectTimeout("QueryConnectTimeout",
                                  "Number of seconds to show the Accept Connection dialog before "
                                  "rejecting the connection",
                                  10);
+IntParameter pollIntervalMin("MinPollInterval",
+                             "Time in milliseconds between polls of the "
+                             "screen while it is changing",
+                             30);
+IntParameter pollIntervalMax("MaxPollInterval",
+                             "Longest time in milliseconds between polls of "
+                             "the screen once it has become idle",
+                             1000);
 
 
 static void CleanupSignalHandler(int sig)
@@ -112,8 +121,9 @@ class XDesktop : public SDesktop, public ColourMap,
 {
 public:
   XDesktop(Display* dpy_)
-    : dpy(dpy_), pb(0), server(0), image(0), oldButtonMask(0),
-      haveXtest(false), pollTimer(this)
+    : dpy(dpy_), captureDpy(0), pb(0), server(0), image(0), backImage(0),
+      poller(0), oldButtonMask(0), haveXtest(false), pollTimer(this),
+      pollInterval(0), fullFramePolls(0), captureInProgress(false)
   {
     int xtestEventBase;
     int xtestErrorBase;
@@ -129,9 +139,16 @@ public:
       vlog.info("unable to inject events or display while server is grabbed");
     }
 
+    // Full screen captures are done over a separate connection so that the
+    // events marking their completion are not swallowed by TXWindow.
+    captureDpy = XOpenDisplay(DisplayString(dpy));
+    if (!captureDpy)
+      vlog.info("unable to open capture connection - not pipelining captures");
   }
   virtual ~XDesktop() {
     stop();
+    if (captureDpy)
+      XCloseDisplay(captureDpy);
   }
 
   // -=- SDesktop interface
@@ -141,9 +158,17 @@ public:
     int dpyHeight = DisplayHeight(dpy, DefaultScreen(dpy));
     Visual* vis = DefaultVisual(dpy, DefaultScreen(dpy));
 
-    image = new Image(dpy, dpyWidth, dpyHeight);
+    image = new Image(captureDpy ? captureDpy : dpy, dpyWidth, dpyHeight);
     image->get(DefaultRootWindow(dpy));
 
+    if (captureDpy) {
+      backImage = new Image(captureDpy, dpyWidth, dpyHeight);
+      if (!backImage->canGetAsync()) {
+        delete backImage;
+        backImage = 0;
+      }
+    }
+
     pf.bpp = image->xim->bits_per_pixel;
     pf.depth = image->xim->depth;
     pf.bigEndian = (image->xim->byte_order == MSBFirst);
@@ -159,17 +184,31 @@ public:
                                   (rdr::U8*)image->xim->data, this);
     server = vs;
     server->setPixelBuffer(pb);
-    pollTimer.start(50);
+    poller = new PollingManager(dpy, image, server);
+    pollInterval = pollIntervalMin;
+    pollTimer.start(pollInterval);
   }
 
   virtual void stop() {
     pollTimer.stop();
+    if (captureInProgress) {
+      XSync(captureDpy, True);
+      captureInProgress = false;
+    }
+    fullFramePolls = 0;
+    delete poller;
+    poller = 0;
     delete pb;
+    pb = 0;
     delete image;
+    image = 0;
+    delete backImage;
+    backImage = 0;
   }
 
   virtual void pointerEvent(const Point& pos, int buttonMask) {
     if (!haveXtest) return;
+    resetPollInterval();
     XTestFakeMotionEvent(dpy, DefaultScreen(dpy), pos.x, pos.y, CurrentTime);
     if (buttonMask != oldButtonMask) {
       for (int i = 0; i < 5; i++) {
@@ -187,6 +226,7 @@ public:
 
   virtual void keyEvent(rdr::U32 key, bool down) {
     if (!haveXtest) return;
+    resetPollInterval();
     int keycode = XKeysymToKeycode(dpy, key);
     if (keycode)
       XTestFakeKeyEvent(dpy, keycode, down, CurrentTime);
@@ -195,6 +235,11 @@ public:
   virtual void clientCutText(const char* str, int len) {
   }
 
+  virtual void inputFlush() {
+    if (haveXtest)
+      XFlush(dpy);
+  }
+
   virtual Point getFbSize() {
     return Point(pb->width(), pb->height());
   }
@@ -214,24 +259,112 @@ public:
   }
 
   // -=- Timer::Callback interface
+  // The poll interval drops to MinPollInterval as soon as a change is seen and
+  // then grows by a quarter on each poll which finds nothing, up to
+  // MaxPollInterval.  Since each poll only samples part of the screen the
+  // interval must not grow too quickly.  If sampling finds a large part of
+  // the screen changing we switch to capturing whole frames for a while.
   virtual bool handleTimeout(Timer* t) {
     if (server->clientsReadyForUpdate()) {
+      if (fullFramePolls > 0) {
+        pollFullFrame();
+        pollInterval = pollIntervalMin;
+      } else {
+        int changed = poller->poll();
+        if (changed) {
+          server->tryUpdate();
+          pollInterval = pollIntervalMin;
+          if (changed * 4 >= poller->numTiles())
+            fullFramePolls = PollingManager::TILE_SIZE;
+        } else {
+          pollInterval = __rfbmin(pollInterval + pollInterval / 4 + 1,
+                                  (int)pollIntervalMax);
+        }
+      }
+    }
+    t->start(pollInterval);
+    return false;
+  }
+
+  // processCaptureEvents() must be called whenever the capture connection
+  // may have events to read.  It completes any outstanding capture.
+  void processCaptureEvents() {
+    if (!captureDpy) return;
+    while (XPending(captureDpy)) {
+      XEvent ev;
+      XNextEvent(captureDpy, &ev);
+      if (captureInProgress && backImage->isGetDone(&ev))
+        captureDone();
+    }
+  }
+
+  int getCaptureFd() {
+    return captureDpy ? ConnectionNumber(captureDpy) : -1;
+  }
+
+protected:
+  // pollFullFrame() captures the whole screen.  If we have a second image
+  // backed by a shared memory pixmap the capture is asynchronous - it is
+  // started here and finished by captureDone().  Otherwise we just fetch the
+  // screen into the image the server is using.
+  void pollFullFrame() {
+    fullFramePolls--;
+    if (!backImage) {
       image->get(DefaultRootWindow(dpy));
       server->add_changed(pb->getRect());
       server->tryUpdate();
+      return;
+    }
+    if (!captureInProgress) {
+      backImage->startGet(DefaultRootWindow(dpy));
+      captureInProgress = true;
+    }
+  }
+
+  // captureDone() swaps the newly captured image in for the one the server
+  // is using.  The capture of the following frame is started before the
+  // update is sent, so that the X server copies it while we encode this one.
+  // With no client waiting for an update it is left to the poll timer.
+  void captureDone() {
+    captureInProgress = false;
+    Image* tmp = image;
+    image = backImage;
+    backImage = tmp;
+    pb->setData((rdr::U8*)image->xim->data);
+    poller->setImage(image);
+    server->add_changed(pb->getRect());
+
+    if (fullFramePolls > 0 && server->clientsReadyForUpdate()) {
+      fullFramePolls--;
+      backImage->startGet(DefaultRootWindow(dpy));
+      captureInProgress = true;
+    }
+    server->tryUpdate();
+  }
+
+  // resetPollInterval() is called on input from a client, since that is
+  // likely to be followed by changes to the screen.
+  void resetPollInterval() {
+    if (pollInterval > pollIntervalMin) {
+      pollInterval = pollIntervalMin;
+      pollTimer.start(pollInterval);
     }
-    return true;
   }
 
-protected:
   Display* dpy;
+  Display* captureDpy;
   PixelFormat pf;
-  PixelBuffer* pb;
+  FullFramePixelBuffer* pb;
   VNCServer* server;
   Image* image;
+  Image* backImage;
+  PollingManager* poller;
   int oldButtonMask;
   bool haveXtest;
   Timer pollTimer;
+  int pollInterval;
+  int fullFramePolls;
+  bool captureInProgress;
 };
 
 char* programName;
@@ -314,6 +447,10 @@ int main(int argc, char** argv)
         tv.tv_usec = (timeoutMs % 1000) * 1000;
         tvp = &tv;
       }
+
+      // Complete any screen capture, including one whose completion event was
+      // read while a timer was being handled
+      desktop.processCaptureEvents();
     
       // Wait for X events, VNC traffic, or the next timer expiry
       // NB: This code assumes that:
@@ -322,6 +459,8 @@ int main(int argc, char** argv)
       FD_ZERO(&rfds);
       FD_SET(listener.getFd(), &rfds);
       FD_SET(ConnectionNumber(dpy), &rfds);
+      if (desktop.getCaptureFd() >= 0)
+        FD_SET(desktop.getCaptureFd(), &rfds);
       server.getSockets(&sockets);
       for (i = sockets.begin(); i != sockets.end(); i++) {
         if ((*i)->isShutdown()) {
@@ -0,0 +1,124 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __DAMAGETILES_H__
+#define __DAMAGETILES_H__
+
+// DamageTiles accumulates damage to the screen as a bitmap with one bit per
+// TILE_SIZE by TILE_SIZE tile.  Adding a rectangle just sets the bits of the
+// tiles it touches, which is much cheaper than a region union, at the cost of
+// rounding the damage out to tile boundaries.  getRegion() converts the
+// accumulated damage to an rfb::Region and clears the bitmap.  numTiles()
+// gives a cheap measure of how much damage there is.
+
+#include <string.h>
+#include <vector>
+#include <rdr/types.h>
+#include <rfb/Region.h>
+#include <rfb/util.h>
+
+class DamageTiles {
+public:
+  enum { TILE_SHIFT = 4, TILE_SIZE = 1 << TILE_SHIFT };
+
+  DamageTiles() : width(0), height(0), tilesX(0), tilesY(0), wordsPerRow(0),
+                  bits(0), count(0) {}
+  ~DamageTiles() { delete [] bits; }
+
+  void init(int width_, int height_) {
+    delete [] bits;
+    width = width_;
+    height = height_;
+    tilesX = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+    tilesY = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+    wordsPerRow = (tilesX + 31) / 32;
+    bits = new rdr::U32[wordsPerRow * tilesY];
+    memset(bits, 0, wordsPerRow * tilesY * sizeof(rdr::U32));
+    count = 0;
+  }
+
+  void clear() {
+    if (count == 0) return;
+    memset(bits, 0, wordsPerRow * tilesY * sizeof(rdr::U32));
+    count = 0;
+  }
+
+  bool isEmpty() const { return count == 0; }
+  int numTiles() const { return count; }
+
+  void add(int x1, int y1, int x2, int y2) {
+    x1 = __rfbmax(x1, 0);
+    y1 = __rfbmax(y1, 0);
+    x2 = __rfbmin(x2, width);
+    y2 = __rfbmin(y2, height);
+    if (x1 >= x2 || y1 >= y2) return;
+
+    int tx1 = x1 >> TILE_SHIFT;
+    int tx2 = (x2 - 1) >> TILE_SHIFT;
+    int ty2 = (y2 - 1) >> TILE_SHIFT;
+    for (int ty = y1 >> TILE_SHIFT; ty <= ty2; ty++) {
+      rdr::U32* row = bits + ty * wordsPerRow;
+      for (int tx = tx1; tx <= tx2; tx++) {
+        rdr::U32 bit = 1U << (tx & 31);
+        if (!(row[tx >> 5] & bit)) {
+          row[tx >> 5] |= bit;
+          count++;
+        }
+      }
+    }
+  }
+
+  // getRegion() sets reg to the accumulated damage.  Each row of tiles gives
+  // one rectangle per run of damaged tiles, so the rectangles come out in the
+  // order expected by setOrderedRects().
+  void getRegion(rfb::Region* reg) {
+    std::vector<rfb::Rect> rects;
+    for (int ty = 0; ty < tilesY; ty++) {
+      rdr::U32* row = bits + ty * wordsPerRow;
+      int y1 = ty << TILE_SHIFT;
+      int y2 = __rfbmin(y1 + TILE_SIZE, height);
+      int tx = 0;
+      while (tx < tilesX) {
+        if (!row[tx >> 5]) {
+          tx = (tx + 32) & ~31;
+          continue;
+        }
+        if (!(row[tx >> 5] & (1U << (tx & 31)))) {
+          tx++;
+          continue;
+        }
+        int start = tx;
+        while (tx < tilesX && (row[tx >> 5] & (1U << (tx & 31))))
+          tx++;
+        rects.push_back(rfb::Rect(start << TILE_SHIFT, y1,
+                                  __rfbmin(tx << TILE_SHIFT, width), y2));
+      }
+      memset(row, 0, wordsPerRow * sizeof(rdr::U32));
+    }
+    reg->setOrderedRects(rects);
+    count = 0;
+  }
+
+private:
+  int width, height;
+  int tilesX, tilesY;
+  int wordsPerRow;
+  rdr::U32* bits;
+  int count;
+};
+
+#endif
@@ -64,6 +64,11 @@ static LogWriter vlog("XserverDesktop");
 rfb::IntParameter deferUpdateTime("DeferUpdate",
                                   "Time in milliseconds to defer updates",40);
 
+rfb::IntParameter minDeferUpdateTime("MinDeferUpdate",
+                                     "Time in milliseconds to defer small "
+                                     "isolated updates when a client is "
+                                     "waiting",1);
+
 rfb::BoolParameter alwaysSetDeferUpdateTimer("AlwaysSetDeferUpdateTimer",
                   "Always reset the defer update timer on every change",false);
 
@@ -72,6 +77,16 @@ IntParameter queryConnectTimeout("QueryConnectTimeout",
                                  "rejecting the connection",
                                  10);
 
+// Number of rows of the screen which grabBuffer can hold
+#define GRAB_BAND_HEIGHT 64
+
+// Damage covering no more than this many tiles counts as a small change for
+// the purposes of choosing how long to defer an update
+#define SMALL_DAMAGE_TILES 16
+
+// How many deferred updates to send between logging the deferral statistics
+#define DEFER_STATS_INTERVAL 1000
+
 static KeyCode KeysymToKeycode(KeySymsPtr keymap, KeySym ks, int* col);
 
 static rdr::U8 reverseBits[] = {
@@ -146,11 +161,13 @@ XserverDesktop::XserverDesktop(ScreenPtr pScreen_,
   : pScreen(pScreen_), deferredUpdateTimer(0), dummyTimer(0),
     server(0), httpServer(0),
     listener(listener_), httpListener(httpListener_),
-    cmap(0), deferredUpdateTimerSet(false),
+    cmap(0), deferredUpdateTimerSet(false), deferKind(DEFER_NORMAL),
+    lastDeferredUpdate(0),
     grabbing(false), ignoreHooks_(false), directFbptr(fbptr != 0),
-    oldButtonMask(0),
+    stride(0), grabBuffer(0), grabBufferSize(0), oldButtonMask(0),
     queryConnectId(0)
 {
+  memset(deferStats, 0, sizeof(deferStats));
   int i;
   format.depth = pScreen->rootDepth;
   for (i = 0; i < screenInfo.numPixmapFormats; i++) {
@@ -188,11 +205,33 @@ XserverDesktop::XserverDesktop(ScreenPtr pScreen_,
 
   width_ = pScreen->width;
   height_ = pScreen->height;
-  if (fbptr)
-    data = (rdr::U8*)fbptr;
-  else
-    data = new rdr::U8[pScreen->width * pScreen->height * (format.bpp/8)];
+  stride = width_;
+
+  // The framebuffer's rows are padded as for a pixmap.  We can use it
+  // directly as long as the padding is a whole number of pixels, otherwise
+  // we must fall back to grabbing the screen with GetImage.
+  int bytesPerPixel = format.bpp/8;
+  if (directFbptr) {
+    int paddedBytesPerRow = PixmapBytePad(width_, format.depth);
+    if (bytesPerPixel && paddedBytesPerRow % bytesPerPixel == 0) {
+      stride = paddedBytesPerRow / bytesPerPixel;
+      data = (rdr::U8*)fbptr;
+    } else {
+      vlog.info("framebuffer rows padded to %d bytes - using GetImage",
+                paddedBytesPerRow);
+      directFbptr = false;
+    }
+  }
+  if (!directFbptr) {
+    data = new rdr::U8[width_ * height_ * bytesPerPixel];
+    grabBufferSize = PixmapBytePad(width_, format.depth) * GRAB_BAND_HEIGHT;
+    grabBuffer = new char[grabBufferSize];
+  }
   colourmap = this;
+  damage.init(width_, height_);
+  unhintedDamage.init(width_, height_);
+  for (int h = 0; h < rfb::numContentHints; h++)
+    hintDamage[h].init(width_, height_);
 
   serverReset(pScreen);
 
@@ -206,8 +245,10 @@ XserverDesktop::XserverDesktop(ScreenPtr pScreen_,
 
 XserverDesktop::~XserverDesktop()
 {
+  logDeferStats();
   if (!directFbptr)
     delete [] data;
+  delete [] grabBuffer;
   TimerFree(deferredUpdateTimer);
   TimerFree(dummyTimer);
   delete httpServer;
@@ -437,7 +478,11 @@ CARD32 XserverDesktop::deferredUpdateTimerCallback(OsTimerPtr timer,
 {
   XserverDesktop* desktop = (XserverDesktop*)arg;
   desktop->deferredUpdateTimerSet = false;
+  desktop->lastDeferredUpdate = now;
+  if (++desktop->deferStats[DEFER_UPDATES] % DEFER_STATS_INTERVAL == 0)
+    desktop->logDeferStats();
   try {
+    desktop->flushDamage();
     desktop->server->tryUpdate();
   } catch (rdr::Exception& e) {
     vlog.error("XserverDesktop::deferredUpdateTimerCallback: %s",e.str());
@@ -445,36 +490,153 @@ CARD32 XserverDesktop::deferredUpdateTimerCallback(OsTimerPtr timer,
   return 0;
 }
 
+// chooseDeferKind() decides how long to defer an update.  A small change
+// which follows a quiet period, such as the echo of a keystroke, is sent after
+// only MinDeferUpdate milliseconds if a client is waiting for it.  While
+// damage keeps streaming in, or when there is nobody to send it to yet, we
+// wait the full DeferUpdate time so that more changes get coalesced.
+
+XserverDesktop::DeferKind XserverDesktop::chooseDeferKind()
+{
+  if (!server->clientsReadyForUpdate())
+    return DEFER_NO_CLIENT;
+  if (GetTimeInMillis() - lastDeferredUpdate < 2 * (CARD32)deferUpdateTime)
+    return DEFER_STREAMING;
+  if (damage.numTiles() <= SMALL_DAMAGE_TILES &&
+      minDeferUpdateTime < deferUpdateTime)
+    return DEFER_SHORT;
+  return DEFER_NORMAL;
+}
+
+void XserverDesktop::startDeferTimer(DeferKind kind)
+{
+  deferKind = kind;
+  deferStats[kind]++;
+  deferredUpdateTimerSet = true;
+  deferredUpdateTimer = TimerSet(deferredUpdateTimer, 0,
+                                 (kind == DEFER_SHORT ? minDeferUpdateTime
+                                  : deferUpdateTime),
+                                 deferredUpdateTimerCallback, this);
+}
+
 void XserverDesktop::deferUpdate()
 {
   if (deferUpdateTime != 0) {
     if (!deferredUpdateTimerSet || alwaysSetDeferUpdateTimer) {
-      deferredUpdateTimerSet = true;
-      deferredUpdateTimer = TimerSet(deferredUpdateTimer, 0,
-                                     deferUpdateTime,
-                                     deferredUpdateTimerCallback, this);
+      startDeferTimer(chooseDeferKind());
+    } else if (deferKind == DEFER_SHORT &&
+               damage.numTiles() > SMALL_DAMAGE_TILES) {
+      // What looked like a small change has grown, so give it the full time
+      startDeferTimer(DEFER_EXTENDED);
     }
   } else {
+    flushDamage();
     server->tryUpdate();
   }
 }
 
+// framebufferUpdateRequest() is called when a client becomes ready for an
+// update.  If the pending update was deferred for the full time only because
+// nobody was waiting for it, we may be able to send it sooner.
+
+void XserverDesktop::framebufferUpdateRequest()
+{
+  if (deferredUpdateTimerSet && deferKind == DEFER_NO_CLIENT) {
+    DeferKind kind = chooseDeferKind();
+    if (kind == DEFER_SHORT)
+      startDeferTimer(kind);
+  }
+}
+
+void XserverDesktop::logDeferStats()
+{
+  vlog.info("deferred updates: %d sent, %d short, %d extended, %d normal, "
+            "%d streaming, %d waiting for client",
+            deferStats[DEFER_UPDATES], deferStats[DEFER_SHORT],
+            deferStats[DEFER_EXTENDED], deferStats[DEFER_NORMAL],
+            deferStats[DEFER_STREAMING], deferStats[DEFER_NO_CLIENT]);
+}
+
+// flushDamage() passes the damage accumulated by add_changed() on to the
+// server.  It must be called before anything which depends on the server
+// knowing about all changes so far, in particular before adding a copy, since
+// the copy may move areas which have been drawn to.
+//
+// Tiles touched only by one kind of hinted drawing operation are then passed
+// on as hints.  A tile touched by more than one kind, or by anything unhinted,
+// gets no hint.
+
+void XserverDesktop::flushDamage()
+{
+  if (damage.isEmpty()) return;
+  rfb::Region rfbReg;
+  damage.getRegion(&rfbReg);
+  server->add_changed(rfbReg);
+
+  bool hinted = false;
+  for (int h = 0; h < rfb::numContentHints; h++)
+    if (!hintDamage[h].isEmpty()) hinted = true;
+  if (!hinted) {
+    unhintedDamage.clear();
+    return;
+  }
+
+  rfb::Region claimed, contested;
+  rfb::Region hintReg[rfb::numContentHints];
+  unhintedDamage.getRegion(&claimed);
+  for (int h = 0; h < rfb::numContentHints; h++) {
+    if (hintDamage[h].isEmpty()) continue;
+    hintDamage[h].getRegion(&hintReg[h]);
+    contested.assign_union(hintReg[h].intersect(claimed));
+    claimed.assign_union(hintReg[h]);
+  }
+  for (int h = 0; h < rfb::numContentHints; h++) {
+    if (hintReg[h].is_empty()) continue;
+    hintReg[h].assign_subtract(contested);
+    if (!hintReg[h].is_empty())
+      server->add_hint(hintReg[h], (rfb::ContentHint)h);
+  }
+}
+
+// add_changed() is called for every drawing operation, so rather than doing a
+// region union each time we just mark the affected tiles in the damage bitmap
+// until the deferred update timer goes off.  The hinted variant also records
+// the kind of operation which did the drawing.
+
 void XserverDesktop::add_changed(RegionPtr reg)
 {
   if (ignoreHooks_) return;
   if (grabbing) return;
   try {
-    rfb::Region rfbReg;
-    rfbReg.setExtentsAndOrderedRects((ShortRect*)REGION_EXTENTS(pScreen, reg),
-                                     REGION_NUM_RECTS(reg),
-                                     (ShortRect*)REGION_RECTS(reg));
-    server->add_changed(rfbReg);
+    addDamage(reg, &unhintedDamage);
     deferUpdate();
   } catch (rdr::Exception& e) {
     vlog.error("XserverDesktop::add_changed: %s",e.str());
   }
 }
 
+void XserverDesktop::add_changed(RegionPtr reg, rfb::ContentHint hint)
+{
+  if (ignoreHooks_) return;
+  if (grabbing) return;
+  try {
+    addDamage(reg, &hintDamage[hint]);
+    deferUpdate();
+  } catch (rdr::Exception& e) {
+    vlog.error("XserverDesktop::add_changed: %s",e.str());
+  }
+}
+
+void XserverDesktop::addDamage(RegionPtr reg, DamageTiles* tiles)
+{
+  int nRects = REGION_NUM_RECTS(reg);
+  BoxPtr rects = REGION_RECTS(reg);
+  for (int i = 0; i < nRects; i++) {
+    damage.add(rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+    tiles->add(rects[i].x1, rects[i].y1, rects[i].x2, rects[i].y2);
+  }
+}
+
 void XserverDesktop::add_copied(RegionPtr dst, int dx, int dy)
 {
   if (ignoreHooks_) return;
@@ -484,6 +646,7 @@ void XserverDesktop::add_copied(RegionPtr dst, int dx, int dy)
     rfbReg.setExtentsAndOrderedRects((ShortRect*)REGION_EXTENTS(pScreen, dst),
                                      REGION_NUM_RECTS(dst),
                                      (ShortRect*)REGION_RECTS(dst));
+    flushDamage();
     server->add_copied(rfbReg, rfb::Point(dx, dy));
     deferUpdate();
   } catch (rdr::Exception& e) {
@@ -703,6 +866,13 @@ void XserverDesktop::clientCutText(const char* str, int len)
   vncClientCutText(str, len);
 }
 
+// grabRegion() fetches the given region of the screen into our framebuffer,
+// fetching as many rows of each rectangle as possible with one GetImage call.
+// GetImage pads each row it returns as for a pixmap, so rows can only be
+// fetched straight into the framebuffer when the rectangle spans its whole
+// width and the padding agrees.  Otherwise bands of rows are fetched into
+// grabBuffer and copied into place.
+
 void XserverDesktop::grabRegion(const rfb::Region& region)
 {
   if (directFbptr) return;
@@ -714,18 +884,33 @@ void XserverDesktop::grabRegion(const rfb::Region& region)
   grabbing = true;
 
   int bytesPerPixel = format.bpp/8;
-  int bytesPerRow = pScreen->width * bytesPerPixel;
+  int bytesPerRow = stride * bytesPerPixel;
+  DrawablePtr pDrawable = (DrawablePtr)WindowTable[pScreen->myNum];
 
   std::vector<rfb::Rect> rects;
   std::vector<rfb::Rect>::iterator i;
   region.get_rects(&rects);
   for (i = rects.begin(); i != rects.end(); i++) {
-    for (int y = i->tl.y; y < i->br.y; y++) {
-      (*pScreen->GetImage) ((DrawablePtr)WindowTable[pScreen->myNum],
-                            i->tl.x, y, i->width(), 1,
-                            ZPixmap, (unsigned long)~0L,
-                            ((char*)data
-                             + y * bytesPerRow + i->tl.x * bytesPerPixel));
+    int w = i->width();
+    int rowBytes = w * bytesPerPixel;
+    int paddedRowBytes = PixmapBytePad(w, format.depth);
+    rdr::U8* dest = data + i->tl.y * bytesPerRow + i->tl.x * bytesPerPixel;
+
+    if (w == width_ && paddedRowBytes == bytesPerRow) {
+      (*pScreen->GetImage) (pDrawable, i->tl.x, i->tl.y, w, i->height(),
+                            ZPixmap, (unsigned long)~0L, (char*)dest);
+      continue;
+    }
+
+    int bandHeight = grabBufferSize / paddedRowBytes;
+    for (int y = i->tl.y; y < i->br.y; y += bandHeight) {
+      int h = __rfbmin(bandHeight, i->br.y - y);
+      (*pScreen->GetImage) (pDrawable, i->tl.x, y, w, h,
+                            ZPixmap, (unsigned long)~0L, grabBuffer);
+      for (int row = 0; row < h; row++) {
+        memcpy(dest, grabBuffer + row * paddedRowBytes, rowBytes);
+        dest += bytesPerRow;
+      }
     }
   }
   grabbing = false;
@@ -28,6 +28,7 @@
 #include <rfb/Configuration.h>
 #include <rfb/VNCServerST.h>
 #include <rdr/SubstitutingInStream.h>
+#include "DamageTiles.h"
 
 extern "C" {
 #define class c_class;
@@ -60,6 +61,7 @@ public:
   void serverCutText(const char* str, int len);
   void setCursor(CursorPtr cursor);
   void add_changed(RegionPtr reg);
+  void add_changed(RegionPtr reg, rfb::ContentHint hint);
   void add_copied(RegionPtr dst, int dx, int dy);
   void positionCursor();
   void ignoreHooks(bool b) { ignoreHooks_ = b; }
@@ -88,10 +90,12 @@ public:
   virtual void pointerEvent(const rfb::Point& pos, int buttonMask);
   virtual void keyEvent(rdr::U32 key, bool down);
   virtual void clientCutText(const char* str, int len);
+  virtual void framebufferUpdateRequest();
   virtual rfb::Point getFbSize() { return rfb::Point(width(), height()); }
 
   // rfb::PixelBuffer callbacks
   virtual void grabRegion(const rfb::Region& r);
+  virtual int getStride() const { return stride; }
 
   // rfb::ColourMap callbacks
   virtual void lookup(int index, int* r, int* g, int* b);
@@ -105,10 +109,20 @@ public:
                                                         char** reason);
 
 private:
+  // The reasons for deferring an update for a particular time, which also
+  // index deferStats.  DEFER_UPDATES counts the deferred updates sent.
+  enum DeferKind { DEFER_SHORT, DEFER_EXTENDED, DEFER_NORMAL, DEFER_STREAMING,
+                   DEFER_NO_CLIENT, DEFER_UPDATES, DEFER_NKINDS };
+
   void setColourMapEntries(int firstColour, int nColours);
   static CARD32 deferredUpdateTimerCallback(OsTimerPtr timer, CARD32 now,
                                             pointer arg);
   void deferUpdate();
+  DeferKind chooseDeferKind();
+  void startDeferTimer(DeferKind kind);
+  void logDeferStats();
+  void flushDamage();
+  void addDamage(RegionPtr reg, DamageTiles* tiles);
   ScreenPtr pScreen;
   OsTimerPtr deferredUpdateTimer, dummyTimer;
   rfb::VNCServerST* server;
@@ -117,9 +131,18 @@ private:
   network::TcpListener* httpListener;
   ColormapPtr cmap;
   bool deferredUpdateTimerSet;
+  DeferKind deferKind;
+  CARD32 lastDeferredUpdate;
+  int deferStats[DEFER_NKINDS];
+  DamageTiles damage;
+  DamageTiles unhintedDamage;
+  DamageTiles hintDamage[rfb::numContentHints];
   bool grabbing;
   bool ignoreHooks_;
   bool directFbptr;
+  int stride;
+  char* grabBuffer;
+  int grabBufferSize;
   int oldButtonMask;
   rfb::Point cursorPos, oldCursorPos;
 
@@ -624,7 +624,8 @@ static void vncHooksSetSpans(DrawablePtr pDrawable, GCPtr pGC, char *psrc,
   vncHooksScreen->desktop->add_changed(changed.reg);
 }
 
-// PutImage - changed region is the given rectangle, clipped by pCompositeClip
+// PutImage - changed region is the given rectangle, clipped by pCompositeClip.
+// Full-colour images are hinted as such.
 
 static void vncHooksPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
                              int x, int y, int w, int h, int leftPad,
@@ -645,7 +646,10 @@ static void vncHooksPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
   (*pGC->ops->PutImage) (pDrawable, pGC, depth, x, y, w, h, leftPad, format,
                          pBits);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  if (format == ZPixmap)
+    vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintImage);
+  else
+    vncHooksScreen->desktop->add_changed(changed.reg);
 }
 
 // CopyArea - destination of the copy is the dest rectangle, clipped by
@@ -1162,7 +1166,8 @@ static void vncHooksFillPolygon(DrawablePtr pDrawable, GCPtr pGC, int shape,
 
 // PolyFillRect - changed region is the union of the rectangles, clipped by
 // pCompositeClip.  If there are more than MAX_RECTS_PER_OP rectangles, just
-// use the bounding rect of all the rectangles.
+// use the bounding rect of all the rectangles.  Solid fills of the rectangles
+// themselves are hinted as such.
 
 static void vncHooksPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrects,
                                  xRectangle *rects)
@@ -1213,7 +1218,13 @@ static void vncHooksPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrects,
 
   (*pGC->ops->PolyFillRect) (pDrawable, pGC, nrects, rects);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  // Other raster ops combine the fill with what was there before, so the
+  // result need not be solid.
+  if (pGC->fillStyle == FillSolid && pGC->alu == GXcopy &&
+      nrects <= MAX_RECTS_PER_OP)
+    vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintFill);
+  else
+    vncHooksScreen->desktop->add_changed(changed.reg);
 }
 
 // PolyFillArc - changed region is the union of bounding rects around each arc,
@@ -1318,7 +1329,7 @@ static int vncHooksPolyText8(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
 
   int ret = (*pGC->ops->PolyText8) (pDrawable, pGC, x, y, count, chars);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintText);
 
   return ret;
 }
@@ -1343,7 +1354,7 @@ static int vncHooksPolyText16(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
 
   int ret = (*pGC->ops->PolyText16) (pDrawable, pGC, x, y, count, chars);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintText);
 
   return ret;
 }
@@ -1370,7 +1381,7 @@ static void vncHooksImageText8(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
 
   (*pGC->ops->ImageText8) (pDrawable, pGC, x, y, count, chars);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintText);
 }
 
 // ImageText16 - changed region is bounding rect around count chars, clipped by
@@ -1395,7 +1406,7 @@ static void vncHooksImageText16(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
 
   (*pGC->ops->ImageText16) (pDrawable, pGC, x, y, count, chars);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintText);
 }
 
 // ImageGlyphBlt - changed region is bounding rect around nglyph chars, clipped
@@ -1421,7 +1432,7 @@ static void vncHooksImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x,
 
   (*pGC->ops->ImageGlyphBlt) (pDrawable, pGC, x, y, nglyph, ppci, pglyphBase);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintText);
 }
 
 // PolyGlyphBlt - changed region is bounding rect around nglyph chars, clipped
@@ -1447,7 +1458,7 @@ static void vncHooksPolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x,
 
   (*pGC->ops->PolyGlyphBlt) (pDrawable, pGC, x, y, nglyph, ppci, pglyphBase);
 
-  vncHooksScreen->desktop->add_changed(changed.reg);
+  vncHooksScreen->desktop->add_changed(changed.reg, rfb::hintText);
 }
 
 // PushPixels - changed region is the given rectangle, clipped by